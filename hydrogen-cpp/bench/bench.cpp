@@ -0,0 +1,422 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "const_fold.h"
+#include "dead_store.h"
+#include "elf_writer.h"
+#include "encoder.h"
+#include "generator.h"
+#include "interner.h"
+#include "ir_builder.h"
+#include "ir_opt.h"
+#include "parallel_lexer.h"
+#include "parser.h"
+#include "resolver.h"
+#include "tokenizer.h"
+
+#include "program_gen.h"
+
+// Compile throughput benchmarks. Each (shape, size) case is generated in memory and run in its own
+// child process, so every case reports its own peak RSS. Phases are timed separately, best of --reps
+// runs, and the results are written as one JSON document.
+//
+// The language has no input, so the optimizer folds a generated program down to almost nothing. The
+// backend phases therefore run on the unoptimized IR, as they would for a program with real inputs;
+// the optimizations are timed on their own copies.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options{
+    std::vector<program_gen::Shape> shapes{std::begin(program_gen::shapes), std::end(program_gen::shapes)};
+    std::vector<size_t> sizes{64 * 1024, 1024 * 1024};
+    int reps = 3;
+    uint64_t seed = 1;
+    std::string out_path{};
+};
+
+struct Phase{
+    std::string_view name;
+    double seconds;
+    // Items the phase produced or consumed, with what they are
+    size_t items;
+    std::string_view unit;
+};
+
+void usage(){
+    std::cerr << "Usage: hydro-bench [--shapes a,b,...] [--sizes 64K,1M,...] [--reps N] [--seed N] [--out file.json]\n"
+              << "       hydro-bench --generate <shape> <size> [--seed N] [file.hy]\n"
+              << "Shapes:";
+    for (const program_gen::Shape shape : program_gen::shapes) {
+        std::cerr << ' ' << program_gen::to_string(shape);
+    }
+    std::cerr << std::endl;
+}
+
+// Sizes are bytes with an optional K, M or G suffix
+std::optional<size_t> parse_size(const std::string_view text){
+    size_t end = 0;
+    size_t value;
+    try {
+        value = std::stoull(std::string(text), &end);
+    }
+    catch (const std::exception&) {
+        return {};
+    }
+    const std::string_view suffix = text.substr(end);
+    if (suffix == "K" || suffix == "k") return value << 10;
+    if (suffix == "M" || suffix == "m") return value << 20;
+    if (suffix == "G" || suffix == "g") return value << 30;
+    if (suffix.empty()) return value;
+    return {};
+}
+
+std::vector<std::string_view> split(const std::string_view text){
+    std::vector<std::string_view> parts;
+    size_t begin = 0;
+    while (begin <= text.size()) {
+        const size_t end = std::min(text.find(',', begin), text.size());
+        parts.push_back(text.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return parts;
+}
+
+// Runs `fn` `reps` times and returns the fastest run in seconds. `setup` runs untimed before each
+// run, for phases that consume or modify their input.
+template <typename Setup, typename Fn>
+double best_of(const int reps, Setup&& setup, Fn&& fn){
+    double best = 0;
+    for (int rep = 0; rep < reps; rep++) {
+        setup();
+        const auto start = Clock::now();
+        fn();
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (rep == 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+template <typename Fn>
+double best_of(const int reps, Fn&& fn){
+    return best_of(reps, []{}, std::forward<Fn>(fn));
+}
+
+size_t node_count(const Ast& ast){
+    return ast.expr_kinds.size() + ast.stmt_kinds.size();
+}
+
+size_t inst_count(const IrProg& ir){
+    size_t count = 0;
+    for (const IrBlock& block : ir.blocks) {
+        count += block.phis.size() + block.insts.size() + 1;
+    }
+    return count;
+}
+
+void write_phase(std::ostream& out, const Phase& phase, const size_t source_bytes){
+    out << "{\"name\": \"" << phase.name << "\", \"ms\": " << phase.seconds * 1000
+        << ", \"bytes_per_s\": " << static_cast<double>(source_bytes) / phase.seconds
+        << ", \"" << phase.unit << "\": " << phase.items
+        << ", \"" << phase.unit << "_per_s\": " << static_cast<double>(phase.items) / phase.seconds << "}";
+}
+
+// Runs every phase on one generated program and writes its JSON object to `out`
+void run_case(std::ostream& out, const program_gen::Shape shape, const size_t size, const Options& options){
+    const auto gen_start = Clock::now();
+    const std::string source = program_gen::generate(shape, size, options.seed);
+    const double gen_seconds = std::chrono::duration<double>(Clock::now() - gen_start).count();
+
+    std::vector<Phase> phases;
+
+    size_t tokens = 0;
+    phases.push_back({"lex", best_of(options.reps, [&]{
+        Interner interner;
+        Tokenizer tokenizer(source, interner);
+        tokens = 0;
+        while (tokenizer.next().has_value()) {
+            tokens++;
+        }
+    }), 0, "tokens"});
+    phases.back().items = tokens;
+
+    // Falls back to one thread for sources too small to split
+    phases.push_back({"lex_parallel", best_of(options.reps, [&]{
+        Interner interner;
+        tokens = 0;
+        for (const TokenStream& stream : ParallelLexer(source, interner, std::thread::hardware_concurrency()).lex()) {
+            tokens += stream.tokens.size();
+        }
+    }), 0, "tokens"});
+    phases.back().items = tokens;
+
+    Interner interner;
+    Ast ast;
+    phases.push_back({"parse", best_of(options.reps, [&]{ interner.clear(); }, [&]{
+        ast = Parser(Tokenizer(source, interner)).parse_prog().value();
+    }), 0, "nodes"});
+    phases.back().items = node_count(ast);
+
+    Ast resolved;
+    phases.push_back({"resolve", best_of(options.reps, [&]{ resolved = ast; }, [&]{
+        Resolver(resolved, interner).run();
+    }), node_count(ast), "nodes"});
+
+    Ast folded;
+    phases.push_back({"fold", best_of(options.reps, [&]{ folded = resolved; }, [&]{
+        ConstFolder(folded).fold_prog();
+        DeadStoreElim(folded).run();
+    }), node_count(ast), "nodes"});
+
+    IrProg ir;
+    phases.push_back({"ir_build", best_of(options.reps, [&]{
+        ir = IrBuilder(resolved).build();
+    }), 0, "insts"});
+    phases.back().items = inst_count(ir);
+
+    IrProg optimized;
+    phases.push_back({"ir_opt", best_of(options.reps, [&]{ optimized = ir; }, [&]{
+        IrOptimizer(optimized).run();
+    }), inst_count(ir), "insts"});
+
+    std::vector<Instr> instrs;
+    IrProg lowered;
+    phases.push_back({"codegen", best_of(options.reps, [&]{ lowered = ir; }, [&]{
+        instrs = Generator(std::move(lowered)).gen_prog();
+    }), 0, "instrs"});
+    phases.back().items = instrs.size();
+
+    char path[] = "/tmp/hydro-bench-XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    std::vector<uint8_t> code;
+    phases.push_back({"backend", best_of(options.reps, [&]{
+        code = Encoder(instrs).encode();
+        ElfWriter(code).write(path);
+    }), instrs.size(), "instrs"});
+    ::unlink(path);
+
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+
+    double total = 0;
+    for (const Phase& phase : phases) {
+        total += phase.seconds;
+    }
+
+    out << "{\"shape\": \"" << program_gen::to_string(shape) << "\", \"target_bytes\": " << size
+        << ", \"source_bytes\": " << source.size() << ", \"generate_ms\": " << gen_seconds * 1000
+        << ", \"total_ms\": " << total * 1000
+        << ", \"bytes_per_s\": " << static_cast<double>(source.size()) / total
+        << ", \"tokens\": " << tokens << ", \"nodes\": " << node_count(ast)
+        << ", \"code_bytes\": " << code.size() << ", \"peak_rss_kb\": " << usage.ru_maxrss
+        << ", \"phases\": [";
+    for (size_t i = 0; i < phases.size(); i++) {
+        out << (i == 0 ? "" : ", ");
+        write_phase(out, phases[i], source.size());
+    }
+    out << "]}";
+}
+
+// Runs a case in a child process and returns its JSON object, or an error object if it failed
+std::string run_isolated(const program_gen::Shape shape, const size_t size, const Options& options){
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return "{\"error\": \"pipe failed\"}";
+    }
+    const pid_t pid = fork();
+    if (pid == 0) {
+        ::close(fds[0]);
+        std::ostringstream out;
+        int status = EXIT_SUCCESS;
+        try {
+            run_case(out, shape, size, options);
+        }
+        catch (const std::exception& e) {
+            out.str("");
+            out << "{\"shape\": \"" << program_gen::to_string(shape) << "\", \"target_bytes\": " << size
+                << ", \"error\": \"" << e.what() << "\"}";
+            status = EXIT_FAILURE;
+        }
+        const std::string text = out.str();
+        size_t written = 0;
+        while (written < text.size()) {
+            const ssize_t n = ::write(fds[1], text.data() + written, text.size() - written);
+            if (n <= 0) break;
+            written += static_cast<size_t>(n);
+        }
+        _exit(status);
+    }
+    ::close(fds[1]);
+
+    std::string result;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = ::read(fds[0], buffer, sizeof(buffer))) > 0) {
+        result.append(buffer, static_cast<size_t>(n));
+    }
+    ::close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (result.empty()) {
+        std::ostringstream error;
+        error << "{\"shape\": \"" << program_gen::to_string(shape) << "\", \"target_bytes\": " << size
+              << ", \"error\": \"case crashed (status " << status << ")\"}";
+        return error.str();
+    }
+    return result;
+}
+
+int generate(int argc, char* argv[]){
+    std::optional<program_gen::Shape> shape;
+    size_t size = 0;
+    bool sized = false;
+    uint64_t seed = 1;
+    const char* path = nullptr;
+    for (int i = 2; i < argc; i++) {
+        const std::string_view arg(argv[i]);
+        if (arg == "--seed" && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (!shape.has_value()) {
+            shape = program_gen::parse_shape(arg);
+            if (!shape.has_value()) break;
+        }
+        else if (!sized) {
+            const std::optional<size_t> parsed = parse_size(arg);
+            if (!parsed.has_value()) break;
+            size = parsed.value();
+            sized = true;
+        }
+        else if (path == nullptr) {
+            path = argv[i];
+        }
+        else {
+            sized = false;
+            break;
+        }
+    }
+    if (!shape.has_value() || !sized) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    const std::string source = program_gen::generate(shape.value(), size, seed);
+    if (path == nullptr) {
+        std::cout << source;
+        return EXIT_SUCCESS;
+    }
+    std::ofstream file(path, std::ios::binary);
+    file << source;
+    if (!file) {
+        std::cerr << "Could not write " << path << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+}
+
+int main(int argc, char* argv[]){
+    if (argc >= 2 && std::string_view(argv[1]) == "--generate") {
+        return generate(argc, argv);
+    }
+
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg(argv[i]);
+        if (i + 1 >= argc) {
+            usage();
+            return EXIT_FAILURE;
+        }
+        const std::string_view value(argv[++i]);
+        if (arg == "--shapes") {
+            options.shapes.clear();
+            for (const std::string_view name : split(value)) {
+                const std::optional<program_gen::Shape> shape = program_gen::parse_shape(name);
+                if (!shape.has_value()) {
+                    usage();
+                    return EXIT_FAILURE;
+                }
+                options.shapes.push_back(shape.value());
+            }
+        }
+        else if (arg == "--sizes") {
+            options.sizes.clear();
+            for (const std::string_view text : split(value)) {
+                const std::optional<size_t> size = parse_size(text);
+                if (!size.has_value()) {
+                    usage();
+                    return EXIT_FAILURE;
+                }
+                options.sizes.push_back(size.value());
+            }
+        }
+        else if (arg == "--reps") {
+            options.reps = std::max(1, std::atoi(argv[i]));
+        }
+        else if (arg == "--seed") {
+            options.seed = std::strtoull(argv[i], nullptr, 10);
+        }
+        else if (arg == "--out") {
+            options.out_path = value;
+        }
+        else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::ostringstream out;
+#ifdef __OPTIMIZE__
+    constexpr bool optimized = true;
+#else
+    constexpr bool optimized = false;
+#endif
+    out << "{\"optimized_build\": " << (optimized ? "true" : "false") << ", \"reps\": " << options.reps
+        << ", \"seed\": " << options.seed << ", \"cases\": [\n";
+    bool failed = false;
+    bool first = true;
+    for (const program_gen::Shape shape : options.shapes) {
+        for (const size_t size : options.sizes) {
+            const std::string result = run_isolated(shape, size, options);
+            failed |= result.find("\"error\"") != std::string::npos;
+            out << (first ? "  " : ",\n  ") << result;
+            first = false;
+            std::cerr << program_gen::to_string(shape) << " " << size << " done" << std::endl;
+        }
+    }
+    out << "\n]}\n";
+
+    if (options.out_path.empty()) {
+        std::cout << out.str();
+    }
+    else {
+        std::ofstream file(options.out_path);
+        file << out.str();
+        if (!file) {
+            std::cerr << "Could not write " << options.out_path << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,362 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "driver.h"
+
+// Performance regression check for the code hydro generates. Every program in the corpus is compiled
+// with the driver, and its executable is run --runs times under hardware counters (perf_event_open),
+// counting the instructions, cycles and branches it retires in user space; each counter keeps its
+// lowest run. Those and the code size are written as a plain table that a later run, on the same
+// machine, compares against, failing when any of them grows by more than --threshold percent or a
+// program's exit code changes.
+//
+// Counters the machine doesn't offer, as in many VMs, are reported as `-` and not compared.
+
+namespace {
+
+namespace fs = std::filesystem;
+
+enum class Metric{
+    code_bytes,
+    instructions,
+    cycles,
+    branches
+};
+
+constexpr size_t metric_count = static_cast<size_t>(Metric::branches) + 1;
+
+constexpr std::string_view metric_names[metric_count] = {"code_bytes", "instructions", "cycles", "branches"};
+
+// The hardware event behind each counted metric
+constexpr std::pair<Metric, uint64_t> counters[] = {
+    {Metric::instructions, PERF_COUNT_HW_INSTRUCTIONS},
+    {Metric::cycles, PERF_COUNT_HW_CPU_CYCLES},
+    {Metric::branches, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+};
+
+struct Result{
+    std::string name;
+    int exit_code = 0;
+    std::array<std::optional<uint64_t>, metric_count> values{};
+};
+
+struct Options{
+    std::vector<std::string> inputs{};
+    int runs = 5;
+    double threshold = 5;
+    std::string baseline_path{};
+    std::string save_path{};
+};
+
+void usage(){
+    std::cerr << "Usage: hydro-perf [--runs N] [--threshold PCT] [--baseline file] [--save file] <corpus dir | file.hy> ..."
+              << std::endl;
+}
+
+// Counts one event of `pid` in user space from its next exec on, or returns -1
+int open_counter(const pid_t pid, const uint64_t config){
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0));
+}
+
+// Runs an executable once. The child waits until its counters are open before it execs, so they
+// count the program and nothing of the fork.
+std::optional<Result> run_once(const std::string& path){
+    int go[2];
+    if (pipe2(go, O_CLOEXEC) != 0) {
+        return {};
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        ::close(go[0]);
+        ::close(go[1]);
+        return {};
+    }
+    if (pid == 0) {
+        ::close(go[1]);
+        char byte;
+        while (::read(go[0], &byte, 1) < 0 && errno == EINTR) {}
+        execl(path.c_str(), path.c_str(), nullptr);
+        _exit(127);
+    }
+    ::close(go[0]);
+
+    std::array<int, std::size(counters)> fds{};
+    for (size_t i = 0; i < std::size(counters); i++) {
+        fds[i] = open_counter(pid, counters[i].second);
+    }
+    // Closing the pipe lets the child go
+    ::close(go[1]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    Result result;
+    result.exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    for (size_t i = 0; i < std::size(counters); i++) {
+        uint64_t count;
+        if (fds[i] >= 0 && ::read(fds[i], &count, sizeof(count)) == sizeof(count)) {
+            result.values[static_cast<size_t>(counters[i].first)] = count;
+        }
+        if (fds[i] >= 0) {
+            ::close(fds[i]);
+        }
+    }
+    return result;
+}
+
+// Compiles and runs one program; failures are thrown, compile errors as CompileError
+Result measure(const fs::path& input, const fs::path& work_dir, const int runs){
+    const std::string output = (work_dir / input.stem()).string();
+    const CompileResult compiled = compile_file(input.string(), output, {});
+
+    Result best;
+    best.name = input.filename().string();
+    for (int run = 0; run < runs; run++) {
+        const std::optional<Result> result = run_once(output);
+        if (!result.has_value()) {
+            throw std::runtime_error("could not run " + output);
+        }
+        if (run > 0 && result->exit_code != best.exit_code) {
+            throw std::runtime_error("exit code changed between runs");
+        }
+        best.exit_code = result->exit_code;
+        for (size_t m = 0; m < metric_count; m++) {
+            const std::optional<uint64_t>& value = result->values[m];
+            if (value.has_value() && (run == 0 || value < best.values[m])) {
+                best.values[m] = value;
+            }
+        }
+    }
+    best.values[static_cast<size_t>(Metric::code_bytes)] = compiled.code_bytes;
+    ::unlink(output.c_str());
+    return best;
+}
+
+// Directories contribute their .hy files, sorted so results line up from run to run
+std::vector<fs::path> corpus(const std::vector<std::string>& inputs){
+    std::vector<fs::path> programs;
+    for (const std::string& input : inputs) {
+        if (!fs::is_directory(input)) {
+            programs.emplace_back(input);
+            continue;
+        }
+        std::vector<fs::path> found;
+        for (const fs::directory_entry& entry : fs::directory_iterator(input)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".hy") {
+                found.push_back(entry.path());
+            }
+        }
+        std::ranges::sort(found);
+        programs.insert(programs.end(), found.begin(), found.end());
+    }
+    return programs;
+}
+
+// One line per program: its name, exit code and metrics in Metric order, `-` for a missing one
+void write_results(std::ostream& out, const std::vector<Result>& results){
+    out << "# program exit_code";
+    for (const std::string_view name : metric_names) {
+        out << ' ' << name;
+    }
+    out << '\n';
+    for (const Result& result : results) {
+        out << result.name << ' ' << result.exit_code;
+        for (const std::optional<uint64_t>& value : result.values) {
+            out << ' ';
+            if (value.has_value()) {
+                out << value.value();
+            }
+            else {
+                out << '-';
+            }
+        }
+        out << '\n';
+    }
+}
+
+std::optional<std::vector<Result>> read_results(const std::string& path){
+    std::ifstream file(path);
+    if (!file) {
+        return {};
+    }
+    std::vector<Result> results;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line.starts_with('#')) continue;
+        std::istringstream fields(line);
+        Result result;
+        fields >> result.name >> result.exit_code;
+        for (std::optional<uint64_t>& value : result.values) {
+            std::string field;
+            fields >> field;
+            if (field != "-" && !field.empty()) {
+                value = std::strtoull(field.c_str(), nullptr, 10);
+            }
+        }
+        if (!fields) {
+            return {};
+        }
+        results.push_back(std::move(result));
+    }
+    return results;
+}
+
+// Prints the results, with the change against the baseline where there is one, and returns how many
+// metrics regressed
+size_t report(const std::vector<Result>& results, const std::vector<Result>& baseline, const double threshold){
+    char cell[48];
+    std::snprintf(cell, sizeof(cell), "%-16s %5s", "program", "exit");
+    std::cout << cell;
+    for (const std::string_view name : metric_names) {
+        std::snprintf(cell, sizeof(cell), " %24.*s", static_cast<int>(name.size()), name.data());
+        std::cout << cell;
+    }
+    std::cout << std::endl;
+
+    std::vector<std::string> regressions;
+    for (const Result& result : results) {
+        const auto base = std::ranges::find(baseline, result.name, &Result::name);
+        const bool compared = base != baseline.end();
+        std::snprintf(cell, sizeof(cell), "%-16s %5d", result.name.c_str(), result.exit_code);
+        std::cout << cell;
+        if (compared && base->exit_code != result.exit_code) {
+            regressions.push_back(result.name + ": exit code " + std::to_string(base->exit_code) + " -> "
+                                  + std::to_string(result.exit_code));
+        }
+        for (size_t m = 0; m < metric_count; m++) {
+            const std::optional<uint64_t>& value = result.values[m];
+            if (!value.has_value()) {
+                std::snprintf(cell, sizeof(cell), " %24s", "-");
+                std::cout << cell;
+                continue;
+            }
+            const std::optional<uint64_t> before = compared ? base->values[m] : std::nullopt;
+            if (!before.has_value() || before.value() == 0) {
+                std::snprintf(cell, sizeof(cell), " %24llu", static_cast<unsigned long long>(value.value()));
+                std::cout << cell;
+                continue;
+            }
+            const double change = (static_cast<double>(value.value()) / static_cast<double>(before.value()) - 1) * 100;
+            std::snprintf(cell, sizeof(cell), " %14llu (%+6.1f%%)", static_cast<unsigned long long>(value.value()), change);
+            std::cout << cell;
+            if (change > threshold) {
+                std::snprintf(cell, sizeof(cell), "%+.1f%%", change);
+                regressions.push_back(result.name + ": " + std::string(metric_names[m]) + " " + cell);
+            }
+        }
+        std::cout << std::endl;
+    }
+
+    for (const std::string& regression : regressions) {
+        std::cout << "REGRESSION " << regression << std::endl;
+    }
+    return regressions.size();
+}
+
+}
+
+int main(int argc, char* argv[]){
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg(argv[i]);
+        const bool has_value = i + 1 < argc;
+        if (arg == "--runs" && has_value) {
+            options.runs = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--threshold" && has_value) {
+            options.threshold = std::strtod(argv[++i], nullptr);
+        }
+        else if (arg == "--baseline" && has_value) {
+            options.baseline_path = argv[++i];
+        }
+        else if (arg == "--save" && has_value) {
+            options.save_path = argv[++i];
+        }
+        else if (arg.starts_with('-')) {
+            usage();
+            return EXIT_FAILURE;
+        }
+        else {
+            options.inputs.emplace_back(arg);
+        }
+    }
+    if (options.inputs.empty()) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Result> baseline;
+    if (!options.baseline_path.empty()) {
+        std::optional<std::vector<Result>> read = read_results(options.baseline_path);
+        if (!read.has_value()) {
+            std::cerr << "Could not read baseline " << options.baseline_path << std::endl;
+            return EXIT_FAILURE;
+        }
+        baseline = std::move(read.value());
+    }
+
+    char work_template[] = "/tmp/hydro-perf-XXXXXX";
+    if (mkdtemp(work_template) == nullptr) {
+        std::cerr << "Could not create a work directory" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const fs::path work_dir(work_template);
+
+    std::vector<Result> results;
+    bool failed = false;
+    for (const fs::path& program : corpus(options.inputs)) {
+        try {
+            results.push_back(measure(program, work_dir, options.runs));
+        }
+        catch (const std::exception& e) {
+            std::cerr << program.string() << ": " << e.what() << std::endl;
+            failed = true;
+        }
+    }
+    fs::remove_all(work_dir);
+
+    const bool counted = std::ranges::any_of(results, [](const Result& result){
+        return result.values[static_cast<size_t>(Metric::instructions)].has_value();
+    });
+    if (!results.empty() && !counted) {
+        std::cerr << "Hardware counters are unavailable here; only code size is compared" << std::endl;
+    }
+
+    const size_t regressions = report(results, baseline, options.threshold);
+
+    if (!options.save_path.empty()) {
+        std::ofstream file(options.save_path);
+        write_results(file, results);
+        if (!file) {
+            std::cerr << "Could not write " << options.save_path << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    return failed || regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
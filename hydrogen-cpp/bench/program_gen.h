@@ -0,0 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+
+// Generates valid .hy programs of a given shape and roughly a given size in bytes, for benchmarking.
+// Generation is deterministic for a seed. Divisors are always non-zero literals, so every program
+// compiles and runs.
+namespace program_gen {
+
+enum class Shape{
+    lets,          // long chains of lets, each reading a few recent ones
+    deep_exprs,    // few statements, large expressions nested many parentheses deep
+    elif_chains,   // if/elif/else chains hundreds of arms long
+    nested_scopes, // scopes nested dozens deep, with lets and assignments at every level
+    comments,      // mostly line and block comments, with a little code between them
+    mixed          // all of the above, statement by statement
+};
+
+inline constexpr Shape shapes[] = {
+    Shape::lets, Shape::deep_exprs, Shape::elif_chains, Shape::nested_scopes, Shape::comments, Shape::mixed,
+};
+
+inline std::string_view to_string(const Shape shape){
+    switch (shape) {
+    case Shape::lets:
+        return "lets";
+    case Shape::deep_exprs:
+        return "deep_exprs";
+    case Shape::elif_chains:
+        return "elif_chains";
+    case Shape::nested_scopes:
+        return "nested_scopes";
+    case Shape::comments:
+        return "comments";
+    case Shape::mixed:
+        return "mixed";
+    }
+    return "?";
+}
+
+inline std::optional<Shape> parse_shape(const std::string_view name){
+    for (const Shape shape : shapes) {
+        if (to_string(shape) == name) {
+            return shape;
+        }
+    }
+    return {};
+}
+
+class Generator{
+public:
+    Generator(const Shape shape, const uint64_t seed)
+        : m_shape(shape),
+          m_rng(seed)
+    {}
+
+    std::string generate(const size_t target_bytes){
+        m_out.clear();
+        m_out.reserve(target_bytes + 4096);
+        m_out += "let v0 = 1;\n";
+        m_vars = 1;
+        while (m_out.size() < target_bytes) {
+            gen_stmt(m_shape);
+        }
+        m_out += "exit(v" + std::to_string(m_vars - 1) + ");\n";
+        return std::move(m_out);
+    }
+
+private:
+    static constexpr int max_depth = 24;
+
+    Shape m_shape;
+    std::mt19937_64 m_rng;
+    std::string m_out{};
+    // Top-level variables are v0..v{m_vars - 1}; they are never shadowed, so any of them can be read
+    size_t m_vars = 0;
+    size_t m_scope_names = 0;
+
+    size_t pick(const size_t n){
+        return m_rng() % n;
+    }
+
+    // One of the last few top-level variables, so live ranges stay short as programs grow
+    std::string recent_var(){
+        const size_t window = std::min<size_t>(m_vars, 16);
+        return "v" + std::to_string(m_vars - 1 - pick(window));
+    }
+
+    void gen_operand(){
+        if (pick(3) == 0) {
+            m_out += std::to_string(pick(1000));
+        }
+        else {
+            m_out += recent_var();
+        }
+    }
+
+    void gen_expr(const int depth, const int max){
+        if (depth >= max || pick(4) == 0) {
+            gen_operand();
+            return;
+        }
+        static constexpr std::string_view ops[] = {" + ", " - ", " * "};
+        const bool paren = pick(2) == 0;
+        if (paren) {
+            m_out += '(';
+        }
+        gen_expr(depth + 1, max);
+        if (pick(5) == 0) {
+            m_out += " / ";
+            m_out += std::to_string(1 + pick(16));
+        }
+        else {
+            m_out += ops[pick(std::size(ops))];
+            gen_expr(depth + 1, max);
+        }
+        if (paren) {
+            m_out += ')';
+        }
+    }
+
+    void gen_let(const int depth_limit){
+        m_out += "let v" + std::to_string(m_vars) + " = ";
+        gen_expr(0, depth_limit);
+        m_out += ";\n";
+        m_vars++;
+    }
+
+    void gen_assign(const std::string& name){
+        m_out += name + " = ";
+        gen_expr(0, 4);
+        m_out += ";\n";
+    }
+
+    void gen_stmt(const Shape shape){
+        switch (shape) {
+        case Shape::lets:
+            gen_let(3);
+            break;
+        case Shape::deep_exprs:
+            gen_let(max_depth);
+            break;
+        case Shape::elif_chains:
+            gen_chain();
+            break;
+        case Shape::nested_scopes:
+            gen_scope(0, static_cast<int>(8 + pick(24)));
+            break;
+        case Shape::comments:
+            gen_comments();
+            gen_let(3);
+            break;
+        case Shape::mixed:
+            gen_stmt(shapes[pick(std::size(shapes) - 1)]);
+            break;
+        }
+    }
+
+    void gen_chain(){
+        const std::string target = recent_var();
+        const size_t arms = 16 + pick(240);
+        for (size_t arm = 0; arm < arms; arm++) {
+            m_out += arm == 0 ? "if (" : " elif (";
+            m_out += target + " - " + std::to_string(arm) + ") {\n    ";
+            gen_assign(target);
+            m_out += "}";
+        }
+        m_out += " else {\n    ";
+        gen_assign(target);
+        m_out += "}\n";
+    }
+
+    void gen_scope(const int depth, const int max){
+        m_out += "{\n";
+        const std::string local = "s" + std::to_string(m_scope_names++);
+        m_out += "let " + local + " = ";
+        gen_expr(0, 3);
+        m_out += ";\n";
+        if (depth < max) {
+            gen_scope(depth + 1, max);
+        }
+        gen_assign(local);
+        m_out += recent_var() + " = " + local + ";\n";
+        m_out += "}\n";
+    }
+
+    void gen_comments(){
+        const size_t lines = 2 + pick(8);
+        for (size_t i = 0; i < lines; i++) {
+            m_out += "// line comment number " + std::to_string(i) + ", just text to skip over\n";
+        }
+        m_out += "/* block comment\n   spanning a few lines, with * and / inside it * /\n   and an end */\n";
+    }
+};
+
+inline std::string generate(const Shape shape, const size_t target_bytes, const uint64_t seed = 1){
+    return Generator(shape, seed).generate(target_bytes);
+}
+
+}
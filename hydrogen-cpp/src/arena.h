@@ -1,18 +1,68 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator over a list of blocks. Each new block is twice the size of the previous one (up to
+// max_block). It only hands out storage for trivial types, which need no destructor, so releasing
+// the arena is just freeing its blocks.
 class ArenaAllocator{
 public:
+    struct Stats{
+        size_t used;     // bytes handed out to objects
+        size_t wasted;   // alignment padding and tails of blocks left behind when growing
+        size_t reserved; // bytes held in blocks
+        size_t blocks;
+    };
+
     explicit ArenaAllocator(size_t const bytes)
-        : m_size(bytes){
-        m_buffer = static_cast<std::byte*>(malloc(m_size));
-        m_offset = m_buffer;
-    }
+        : m_next_block_size(bytes)
+    {}
 
+    // Uninitialized storage for `count` objects of a trivial type
     template <typename T>
-    T* alloc(){
-        void* offset = m_offset;
-        m_offset += sizeof(T);
-        return static_cast<T*>(offset);
+    T* alloc_array(const size_t count){
+        static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    [[nodiscard]] Stats stats() const{
+        size_t reserved = 0;
+        for (const Block& block : m_blocks) {
+            reserved += block.size;
+        }
+        const size_t tail = m_blocks.empty() ? 0 : static_cast<size_t>(m_end - m_offset);
+        return {
+            .used = m_used,
+            .wasted = reserved - tail - m_used,
+            .reserved = reserved,
+            .blocks = m_blocks.size(),
+        };
+    }
+
+    // Releases everything allocated so far but keeps the largest block, so an arena reused for job
+    // after job stops calling malloc once it has grown to fit the biggest one
+    void reset(){
+        m_used = 0;
+        if (m_blocks.empty()) {
+            return;
+        }
+        const auto largest = std::max_element(m_blocks.begin(), m_blocks.end(),
+                                              [](const Block& a, const Block& b){ return a.size < b.size; });
+        const Block kept = *largest;
+        for (const Block& block : m_blocks) {
+            if (block.data != kept.data) {
+                free(block.data);
+            }
+        }
+        m_blocks.assign(1, kept);
+        m_offset = kept.data;
+        m_end = kept.data + kept.size;
     }
 
     ArenaAllocator(const ArenaAllocator&) = delete;
@@ -20,11 +70,45 @@ public:
     ArenaAllocator& operator=(const ArenaAllocator&) = delete;
 
     ~ArenaAllocator(){
-        free(m_buffer);
+        for (const Block& block : m_blocks) {
+            free(block.data);
+        }
     }
 
 private:
-    size_t m_size;
-    std::byte* m_buffer;
-    std::byte* m_offset;
+    static constexpr size_t max_block = 64 * 1024 * 1024;
+
+    struct Block{
+        std::byte* data;
+        size_t size;
+    };
+
+    void* allocate(const size_t size, const size_t align){
+        auto aligned = (reinterpret_cast<uintptr_t>(m_offset) + align - 1) & ~(align - 1);
+        if (m_offset == nullptr || aligned + size > reinterpret_cast<uintptr_t>(m_end)) {
+            grow(size + align);
+            aligned = (reinterpret_cast<uintptr_t>(m_offset) + align - 1) & ~(align - 1);
+        }
+        m_offset = reinterpret_cast<std::byte*>(aligned + size);
+        m_used += size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    void grow(const size_t min_size){
+        const size_t size = std::max(m_next_block_size, min_size);
+        auto* data = static_cast<std::byte*>(malloc(size));
+        if (data == nullptr) {
+            throw std::bad_alloc();
+        }
+        m_blocks.push_back({.data = data, .size = size});
+        m_offset = data;
+        m_end = data + size;
+        m_next_block_size = std::min(m_next_block_size * 2, max_block);
+    }
+
+    std::vector<Block> m_blocks{};
+    std::byte* m_offset = nullptr;
+    std::byte* m_end = nullptr;
+    size_t m_next_block_size;
+    size_t m_used = 0;
 };
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "out_buffer.h"
+
+enum class Reg : uint8_t{
+    rax,
+    rcx,
+    rdx,
+    rbx,
+    rsp,
+    rbp,
+    rsi,
+    rdi,
+    r8,
+    r9,
+    r10,
+    r11,
+    r12,
+    r13,
+    r14,
+    r15
+};
+
+inline std::string_view to_string(const Reg reg){
+    static const char* names[] = {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+    };
+    return names[static_cast<uint8_t>(reg)];
+}
+
+struct Operand{
+    enum class Kind : uint8_t{
+        none,
+        reg,
+        imm,
+        mem,
+        label,
+        vreg
+    };
+
+    Kind kind = Kind::none;
+    Reg reg = Reg::rax; // register, or base register for mem
+    int64_t imm = 0; // immediate, displacement for mem, label id or vreg id
+
+    [[nodiscard]] bool operator==(const Operand&) const = default;
+};
+
+inline Operand op_reg(const Reg reg){
+    return {.kind = Operand::Kind::reg, .reg = reg};
+}
+
+inline Operand op_imm(const int64_t imm){
+    return {.kind = Operand::Kind::imm, .imm = imm};
+}
+
+inline Operand op_mem(const Reg base, const int64_t disp){
+    return {.kind = Operand::Kind::mem, .reg = base, .imm = disp};
+}
+
+inline Operand op_label(const int id){
+    return {.kind = Operand::Kind::label, .imm = id};
+}
+
+inline Operand op_vreg(const int id){
+    return {.kind = Operand::Kind::vreg, .imm = id};
+}
+
+enum class Op : uint8_t{
+    label,
+    comment,
+    mov,
+    push,
+    pop,
+    add,
+    sub,
+    mul,
+    div,
+    xor_,
+    shl,
+    shr,
+    cmp,
+    je,
+    jne,
+    jmp,
+    syscall,
+    ret
+};
+
+inline std::string_view to_string(const Op op){
+    switch (op) {
+    case Op::label:
+        return "label";
+    case Op::comment:
+        return "comment";
+    case Op::mov:
+        return "mov";
+    case Op::push:
+        return "push";
+    case Op::pop:
+        return "pop";
+    case Op::add:
+        return "add";
+    case Op::sub:
+        return "sub";
+    case Op::mul:
+        return "mul";
+    case Op::div:
+        return "div";
+    case Op::xor_:
+        return "xor";
+    case Op::shl:
+        return "shl";
+    case Op::shr:
+        return "shr";
+    case Op::cmp:
+        return "cmp";
+    case Op::je:
+        return "je";
+    case Op::jne:
+        return "jne";
+    case Op::jmp:
+        return "jmp";
+    case Op::syscall:
+        return "syscall";
+    case Op::ret:
+        return "ret";
+    }
+
+    assert(false);
+    __builtin_unreachable();
+}
+
+struct Instr{
+    Op op;
+    Operand dst{};
+    Operand src{};
+    const char* text = nullptr; // only used by Op::comment
+};
+
+inline OutBuffer& operator<<(OutBuffer& out, const Operand& operand){
+    switch (operand.kind) {
+    case Operand::Kind::none:
+        return out;
+    case Operand::Kind::reg:
+        return out << to_string(operand.reg);
+    case Operand::Kind::imm:
+        return out << operand.imm;
+    case Operand::Kind::mem:
+        return out << "QWORD [" << to_string(operand.reg) << " + " << operand.imm << ']';
+    case Operand::Kind::label:
+        return out << "label" << operand.imm;
+    case Operand::Kind::vreg:
+        return out << 'v' << operand.imm;
+    }
+
+    assert(false);
+    return out;
+}
+
+// Writes the instruction list as nasm source, used for the --asm debug output
+inline void write_asm(OutBuffer& out, const std::vector<Instr>& instrs){
+    out << "global _start\n_start:\n";
+    for (const Instr& instr : instrs) {
+        if (instr.op == Op::label) {
+            out << instr.dst << ":\n";
+            continue;
+        }
+        if (instr.op == Op::comment) {
+            out << "    ;; " << instr.text << '\n';
+            continue;
+        }
+        out << "    " << to_string(instr.op);
+        if (instr.dst.kind != Operand::Kind::none) {
+            out << ' ' << instr.dst;
+        }
+        if (instr.src.kind != Operand::Kind::none) {
+            out << ", " << instr.src;
+        }
+        out << '\n';
+    }
+}
@@ -0,0 +1,349 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "interner.h"
+
+// The AST is stored flat: every node is a 32-bit index into a kind array, and the kind says which
+// per-kind array holds its operands. Children are always created before their parent, so an
+// expression's operands have lower indices than the expression itself.
+
+struct ExprId{
+    uint32_t index;
+
+    [[nodiscard]] bool operator==(const ExprId&) const = default;
+};
+
+struct StmtId{
+    uint32_t index;
+
+    [[nodiscard]] bool operator==(const StmtId&) const = default;
+};
+
+// A statement list; the program and every scope, if arm or loop body has one
+struct BodyId{
+    uint32_t index;
+
+    [[nodiscard]] bool operator==(const BodyId&) const = default;
+};
+
+inline constexpr ExprId no_expr{UINT32_MAX};
+
+enum class ExprKind : uint8_t{
+    int_lit,
+    ident,
+    add,
+    sub,
+    mul,
+    div
+};
+
+enum class StmtKind : uint8_t{
+    exit,
+    let,
+    assign,
+    scope,
+    if_,
+    while_
+};
+
+inline constexpr size_t expr_kind_count = static_cast<size_t>(ExprKind::div) + 1;
+inline constexpr size_t stmt_kind_count = static_cast<size_t>(StmtKind::while_) + 1;
+
+inline std::string_view to_string(const ExprKind kind){
+    switch (kind) {
+    case ExprKind::int_lit:
+        return "int_lit";
+    case ExprKind::ident:
+        return "ident";
+    case ExprKind::add:
+        return "add";
+    case ExprKind::sub:
+        return "sub";
+    case ExprKind::mul:
+        return "mul";
+    case ExprKind::div:
+        return "div";
+    }
+
+    assert(false);
+    __builtin_unreachable();
+}
+
+inline std::string_view to_string(const StmtKind kind){
+    switch (kind) {
+    case StmtKind::exit:
+        return "exit";
+    case StmtKind::let:
+        return "let";
+    case StmtKind::assign:
+        return "assign";
+    case StmtKind::scope:
+        return "scope";
+    case StmtKind::if_:
+        return "if";
+    case StmtKind::while_:
+        return "while";
+    }
+
+    assert(false);
+    __builtin_unreachable();
+}
+
+struct Ident{
+    SymbolId symbol;
+    int line;
+};
+
+struct BinExpr{
+    ExprId lhs;
+    ExprId rhs;
+};
+
+// Operands of a let or an assignment
+struct Store{
+    Ident ident;
+    ExprId expr;
+};
+
+// One arm of an if/elif/else chain; the else arm has no condition
+struct Arm{
+    ExprId cond;
+    BodyId body;
+};
+
+struct IfStmt{
+    uint32_t first_arm;
+    uint32_t arm_count;
+};
+
+struct WhileStmt{
+    ExprId cond;
+    BodyId body;
+};
+
+struct StmtList{
+    uint32_t begin;
+    uint32_t size;
+};
+
+struct Ast{
+    std::vector<ExprKind> expr_kinds{};
+    std::vector<uint32_t> expr_operands{};
+    std::vector<uint64_t> int_lits{};
+    std::vector<Ident> idents{};
+    std::vector<BinExpr> bin_exprs{};
+
+    std::vector<StmtKind> stmt_kinds{};
+    std::vector<uint32_t> stmt_operands{};
+    std::vector<ExprId> exit_exprs{};
+    std::vector<Store> stores{};
+    std::vector<IfStmt> if_stmts{};
+    std::vector<Arm> arms{};
+    std::vector<WhileStmt> while_stmts{};
+
+    std::vector<StmtList> bodies{};
+    std::vector<StmtId> body_stmts{};
+    BodyId root{};
+
+    // Filled in by Resolver: the variable slot of each identifier read and each let/assignment
+    std::vector<uint32_t> ident_slots{};
+    std::vector<uint32_t> store_slots{};
+    uint32_t slot_count = 0;
+
+    [[nodiscard]] ExprKind kind(const ExprId expr) const{
+        return expr_kinds[expr.index];
+    }
+
+    [[nodiscard]] StmtKind kind(const StmtId stmt) const{
+        return stmt_kinds[stmt.index];
+    }
+
+    [[nodiscard]] static bool is_bin(const ExprKind kind){
+        return kind != ExprKind::int_lit && kind != ExprKind::ident;
+    }
+
+    [[nodiscard]] uint64_t int_lit(const ExprId expr) const{
+        return int_lits[expr_operands[expr.index]];
+    }
+
+    // Index of an identifier expression in `idents`, for passes that keep per-read side tables
+    [[nodiscard]] uint32_t ident_index(const ExprId expr) const{
+        return expr_operands[expr.index];
+    }
+
+    [[nodiscard]] const Ident& ident(const ExprId expr) const{
+        return idents[expr_operands[expr.index]];
+    }
+
+    [[nodiscard]] uint32_t slot(const ExprId ident) const{
+        return ident_slots[expr_operands[ident.index]];
+    }
+
+    [[nodiscard]] uint32_t store_slot(const StmtId stmt) const{
+        return store_slots[stmt_operands[stmt.index]];
+    }
+
+    [[nodiscard]] const BinExpr& bin(const ExprId expr) const{
+        return bin_exprs[expr_operands[expr.index]];
+    }
+
+    [[nodiscard]] ExprId exit_expr(const StmtId stmt) const{
+        return exit_exprs[stmt_operands[stmt.index]];
+    }
+
+    // Index of a let or assignment in `stores`
+    [[nodiscard]] uint32_t store_index(const StmtId stmt) const{
+        return stmt_operands[stmt.index];
+    }
+
+    [[nodiscard]] Store& store(const StmtId stmt){
+        return stores[stmt_operands[stmt.index]];
+    }
+
+    [[nodiscard]] const Store& store(const StmtId stmt) const{
+        return stores[stmt_operands[stmt.index]];
+    }
+
+    [[nodiscard]] BodyId scope_body(const StmtId stmt) const{
+        return BodyId{stmt_operands[stmt.index]};
+    }
+
+    [[nodiscard]] IfStmt& if_stmt(const StmtId stmt){
+        return if_stmts[stmt_operands[stmt.index]];
+    }
+
+    [[nodiscard]] std::span<Arm> if_arms(const StmtId stmt){
+        const IfStmt& if_ = if_stmts[stmt_operands[stmt.index]];
+        return {arms.data() + if_.first_arm, if_.arm_count};
+    }
+
+    [[nodiscard]] std::span<const Arm> if_arms(const StmtId stmt) const{
+        const IfStmt& if_ = if_stmts[stmt_operands[stmt.index]];
+        return {arms.data() + if_.first_arm, if_.arm_count};
+    }
+
+    [[nodiscard]] const WhileStmt& while_stmt(const StmtId stmt) const{
+        return while_stmts[stmt_operands[stmt.index]];
+    }
+
+    [[nodiscard]] std::span<StmtId> stmts(const BodyId body){
+        const StmtList& list = bodies[body.index];
+        return {body_stmts.data() + list.begin, list.size};
+    }
+
+    [[nodiscard]] std::span<const StmtId> stmts(const BodyId body) const{
+        const StmtList& list = bodies[body.index];
+        return {body_stmts.data() + list.begin, list.size};
+    }
+
+    // Drops all but the first `size` statements of a body
+    void truncate(const BodyId body, const size_t size){
+        bodies[body.index].size = static_cast<uint32_t>(size);
+    }
+
+    ExprId add_int_lit(const uint64_t value){
+        int_lits.push_back(value);
+        return add_expr(ExprKind::int_lit, int_lits.size() - 1);
+    }
+
+    ExprId add_ident(const Ident& ident){
+        idents.push_back(ident);
+        return add_expr(ExprKind::ident, idents.size() - 1);
+    }
+
+    ExprId add_bin(const ExprKind kind, const ExprId lhs, const ExprId rhs){
+        bin_exprs.push_back({.lhs = lhs, .rhs = rhs});
+        return add_expr(kind, bin_exprs.size() - 1);
+    }
+
+    // Rewrites an expression into a literal in place; its old operands simply become unreachable
+    void set_int_lit(const ExprId expr, const uint64_t value){
+        int_lits.push_back(value);
+        expr_kinds[expr.index] = ExprKind::int_lit;
+        expr_operands[expr.index] = static_cast<uint32_t>(int_lits.size() - 1);
+    }
+
+    StmtId add_exit(const ExprId expr){
+        exit_exprs.push_back(expr);
+        return add_stmt(StmtKind::exit, exit_exprs.size() - 1);
+    }
+
+    StmtId add_store(const StmtKind kind, const Store& store){
+        stores.push_back(store);
+        return add_stmt(kind, stores.size() - 1);
+    }
+
+    StmtId add_scope(const BodyId body){
+        return add_stmt(StmtKind::scope, body.index);
+    }
+
+    StmtId add_if(const std::span<const Arm> if_arms){
+        if_stmts.push_back({.first_arm = static_cast<uint32_t>(arms.size()), .arm_count = static_cast<uint32_t>(if_arms.size())});
+        arms.insert(arms.end(), if_arms.begin(), if_arms.end());
+        return add_stmt(StmtKind::if_, if_stmts.size() - 1);
+    }
+
+    StmtId add_while(const ExprId cond, const BodyId body){
+        while_stmts.push_back({.cond = cond, .body = body});
+        return add_stmt(StmtKind::while_, while_stmts.size() - 1);
+    }
+
+    // Turns a statement into a plain scope over `body`, e.g. an if whose first arm always runs
+    void set_scope(const StmtId stmt, const BodyId body){
+        stmt_kinds[stmt.index] = StmtKind::scope;
+        stmt_operands[stmt.index] = body.index;
+    }
+
+    BodyId add_body(const std::span<const StmtId> list){
+        bodies.push_back({.begin = static_cast<uint32_t>(body_stmts.size()), .size = static_cast<uint32_t>(list.size())});
+        body_stmts.insert(body_stmts.end(), list.begin(), list.end());
+        return BodyId{static_cast<uint32_t>(bodies.size() - 1)};
+    }
+
+private:
+    ExprId add_expr(const ExprKind kind, const size_t operand){
+        expr_kinds.push_back(kind);
+        expr_operands.push_back(static_cast<uint32_t>(operand));
+        return ExprId{static_cast<uint32_t>(expr_kinds.size() - 1)};
+    }
+
+    StmtId add_stmt(const StmtKind kind, const size_t operand){
+        stmt_kinds.push_back(kind);
+        stmt_operands.push_back(static_cast<uint32_t>(operand));
+        return StmtId{static_cast<uint32_t>(stmt_kinds.size() - 1)};
+    }
+};
+
+// Lists the nodes of an expression without recursing, since a long chain like `a + a + ... + a` nests
+// deeper than the call stack goes. Operands come before the node that uses them and left before
+// right, the order a recursive walk would finish them in, so a pass can keep operand results on a
+// stack of its own. The buffers are reused from one expression to the next.
+class ExprWalker{
+public:
+    [[nodiscard]] std::span<const ExprId> postorder(const Ast& ast, const ExprId root){
+        // Visiting each node before its right and then its left operand gives the reverse order
+        m_nodes.clear();
+        m_stack.assign(1, root);
+        while (!m_stack.empty()) {
+            const ExprId expr = m_stack.back();
+            m_stack.pop_back();
+            m_nodes.push_back(expr);
+            if (Ast::is_bin(ast.kind(expr))) {
+                m_stack.push_back(ast.bin(expr).lhs);
+                m_stack.push_back(ast.bin(expr).rhs);
+            }
+        }
+        std::reverse(m_nodes.begin(), m_nodes.end());
+        return m_nodes;
+    }
+
+private:
+    std::vector<ExprId> m_nodes{};
+    std::vector<ExprId> m_stack{};
+};
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "ir.h"
+
+// Register bytecode for the VM. An instruction is its opcode word followed by operand words: register
+// numbers, code offsets, and 64-bit immediates split into a low and a high word. Every SSA value is a
+// register, and registers of constants are filled in before the program starts, so constants cost no
+// instructions.
+enum class BcOp : uint32_t{
+    mov,    // dst, src
+    add,    // dst, lhs, rhs
+    sub,
+    mul,
+    div,
+    add_k,  // dst, lhs, imm
+    sub_k,
+    mul_k,
+    div_k,
+    jmp,    // target
+    br,     // cond, target if cond != 0, target otherwise
+    // Superinstructions for what the IR does most, each replacing a pair of instructions
+    bne,    // lhs, rhs, target if lhs != rhs, target otherwise: a sub only used by the br after it
+    bne_k,  // lhs, imm, target if lhs != imm, target otherwise: the same against a constant
+    mov_jmp, // dst, src, target: the last phi copy of an edge and the jump that follows it
+    exit    // value
+};
+
+inline std::string_view to_string(const BcOp op){
+    switch (op) {
+    case BcOp::mov:
+        return "mov";
+    case BcOp::add:
+        return "add";
+    case BcOp::sub:
+        return "sub";
+    case BcOp::mul:
+        return "mul";
+    case BcOp::div:
+        return "div";
+    case BcOp::add_k:
+        return "add_k";
+    case BcOp::sub_k:
+        return "sub_k";
+    case BcOp::mul_k:
+        return "mul_k";
+    case BcOp::div_k:
+        return "div_k";
+    case BcOp::jmp:
+        return "jmp";
+    case BcOp::br:
+        return "br";
+    case BcOp::bne:
+        return "bne";
+    case BcOp::bne_k:
+        return "bne_k";
+    case BcOp::mov_jmp:
+        return "mov_jmp";
+    case BcOp::exit:
+        return "exit";
+    }
+
+    assert(false);
+    __builtin_unreachable();
+}
+
+struct BytecodeProg{
+    std::vector<uint32_t> code{};
+    std::vector<uint64_t> regs{}; // initial register file, holding the constants
+    size_t instr_count = 0;
+};
+
+// Lowers optimized SSA IR to bytecode. Blocks keep their IR order so most jumps fall through, and
+// phis become copies on the edges into their block, in a stub after the branching block when the
+// edge starts at a br.
+class BytecodeBuilder{
+public:
+    explicit BytecodeBuilder(const IrProg& prog)
+        : m_prog(prog),
+          m_consts(prog.value_count),
+          m_uses(prog.value_count),
+          m_defs(prog.value_count, nullptr),
+          m_def_blocks(prog.value_count),
+          m_labels(prog.blocks.size())
+    {
+        for (BlockId b = 0; b < m_prog.blocks.size(); b++) {
+            const IrBlock& block = m_prog.blocks[b];
+            for (const IrPhi& phi : block.phis) {
+                for (const ValueId arg : phi.args) {
+                    m_uses[arg]++;
+                }
+            }
+            for (const IrInst& inst : block.insts) {
+                m_defs[inst.dst] = &inst;
+                m_def_blocks[inst.dst] = b;
+                if (inst.op == IrOp::const_) {
+                    m_consts[inst.dst] = inst.imm;
+                }
+                else {
+                    m_uses[inst.lhs]++;
+                    m_uses[inst.rhs]++;
+                }
+            }
+            if (block.term.kind != IrTerm::Kind::jmp) {
+                m_uses[block.term.value]++;
+            }
+        }
+    }
+
+    [[nodiscard]] BytecodeProg build(){
+        // One register past the values breaks cycles of phi copies
+        m_out.regs.assign(m_prog.value_count + 1, 0);
+        for (ValueId v = 0; v < m_prog.value_count; v++) {
+            m_out.regs[v] = m_consts[v].value_or(0);
+        }
+
+        for (BlockId b = 0; b < m_prog.blocks.size(); b++) {
+            m_labels[b] = static_cast<uint32_t>(m_out.code.size());
+            const std::optional<ValueId> fused = fused_cond(b);
+            for (const IrInst& inst : m_prog.blocks[b].insts) {
+                if (inst.dst != fused) {
+                    build_inst(inst);
+                }
+            }
+            build_term(b, fused);
+        }
+
+        for (const auto& [pos, label] : m_fixups) {
+            m_out.code[pos] = m_labels[label];
+        }
+        return std::move(m_out);
+    }
+
+private:
+    const IrProg& m_prog;
+    std::vector<std::optional<uint64_t>> m_consts;
+    std::vector<uint32_t> m_uses;
+    std::vector<const IrInst*> m_defs;
+    std::vector<BlockId> m_def_blocks;
+    // Code offset of each block, then of each edge stub
+    std::vector<uint32_t> m_labels;
+    std::vector<std::pair<size_t, size_t>> m_fixups{};
+    BytecodeProg m_out{};
+
+    [[nodiscard]] ValueId temp() const{
+        return m_prog.value_count;
+    }
+
+    void emit(const BcOp op, const std::initializer_list<uint32_t> operands = {}){
+        m_out.code.push_back(static_cast<uint32_t>(op));
+        m_out.code.insert(m_out.code.end(), operands.begin(), operands.end());
+        m_out.instr_count++;
+    }
+
+    void imm(const uint64_t value){
+        m_out.code.push_back(static_cast<uint32_t>(value));
+        m_out.code.push_back(static_cast<uint32_t>(value >> 32));
+    }
+
+    void label_ref(const size_t label){
+        m_fixups.emplace_back(m_out.code.size(), label);
+        m_out.code.push_back(0);
+    }
+
+    void build_inst(const IrInst& inst){
+        static constexpr std::pair<BcOp, BcOp> ops[] = {
+            {BcOp::mov, BcOp::mov}, // const_, which needs no code
+            {BcOp::add, BcOp::add_k},
+            {BcOp::sub, BcOp::sub_k},
+            {BcOp::mul, BcOp::mul_k},
+            {BcOp::div, BcOp::div_k},
+        };
+        if (inst.op == IrOp::const_) {
+            return;
+        }
+        const auto [op, op_k] = ops[static_cast<size_t>(inst.op)];
+        if (const std::optional<uint64_t> k = m_consts[inst.rhs]) {
+            emit(op_k, {inst.dst, inst.lhs});
+            imm(k.value());
+            return;
+        }
+        emit(op, {inst.dst, inst.lhs, inst.rhs});
+    }
+
+    // A br on a sub that nothing else reads is fused with it into a bne, and the sub isn't emitted.
+    // Only within a block, where no phi copy can change the sub's operands before the branch.
+    [[nodiscard]] std::optional<ValueId> fused_cond(const BlockId b) const{
+        const IrTerm& term = m_prog.blocks[b].term;
+        if (term.kind != IrTerm::Kind::br || m_consts[term.value].has_value() || m_uses[term.value] != 1) {
+            return {};
+        }
+        const IrInst* def = m_defs[term.value];
+        if (def == nullptr || def->op != IrOp::sub || m_def_blocks[term.value] != b) {
+            return {};
+        }
+        return term.value;
+    }
+
+    void build_term(const BlockId b, const std::optional<ValueId> fused){
+        const IrTerm& term = m_prog.blocks[b].term;
+        switch (term.kind) {
+        case IrTerm::Kind::exit:
+            emit(BcOp::exit, {term.value});
+            break;
+        case IrTerm::Kind::jmp:
+            build_edge(b, term.target, b + 1);
+            break;
+        case IrTerm::Kind::br: {
+            if (const std::optional<uint64_t> cond = m_consts[term.value]) {
+                build_edge(b, cond.value() != 0 ? term.target : term.else_target, b + 1);
+                break;
+            }
+            const std::optional<size_t> stub = stub_label(term.target);
+            const std::optional<size_t> else_stub = stub_label(term.else_target);
+            if (fused.has_value()) {
+                const IrInst& sub = *m_defs[fused.value()];
+                if (const std::optional<uint64_t> k = m_consts[sub.rhs]) {
+                    emit(BcOp::bne_k, {sub.lhs});
+                    imm(k.value());
+                }
+                else {
+                    emit(BcOp::bne, {sub.lhs, sub.rhs});
+                }
+            }
+            else {
+                emit(BcOp::br, {term.value});
+            }
+            label_ref(stub.value_or(term.target));
+            label_ref(else_stub.value_or(term.else_target));
+            if (stub.has_value()) {
+                m_labels[stub.value()] = static_cast<uint32_t>(m_out.code.size());
+                build_edge(b, term.target, else_stub.has_value() ? std::nullopt : std::optional(b + 1));
+            }
+            if (else_stub.has_value()) {
+                m_labels[else_stub.value()] = static_cast<uint32_t>(m_out.code.size());
+                build_edge(b, term.else_target, b + 1);
+            }
+            break;
+        }
+        }
+    }
+
+    // A br goes straight to a block without phis, and otherwise to a stub with the edge's copies
+    std::optional<size_t> stub_label(const BlockId to){
+        if (m_prog.blocks[to].phis.empty()) {
+            return {};
+        }
+        m_labels.push_back(0);
+        return m_labels.size() - 1;
+    }
+
+    // Copies phi arguments for the edge from -> to, then jumps unless `to` is laid out next
+    void build_edge(const BlockId from, const BlockId to, const std::optional<BlockId> next){
+        const bool jump = next != to;
+        std::vector<std::pair<ValueId, ValueId>> copies = parallel_copy(from, to);
+        if (!copies.empty() && jump) {
+            const auto [dst, src] = copies.back();
+            copies.pop_back();
+            for (const auto& [d, s] : copies) {
+                emit(BcOp::mov, {d, s});
+            }
+            emit(BcOp::mov_jmp, {dst, src});
+            label_ref(to);
+            return;
+        }
+        for (const auto& [d, s] : copies) {
+            emit(BcOp::mov, {d, s});
+        }
+        if (jump) {
+            emit(BcOp::jmp);
+            label_ref(to);
+        }
+    }
+
+    // The copies for an edge in an order that never overwrites a register another copy still has to
+    // read, going through the temporary register to break cycles
+    [[nodiscard]] std::vector<std::pair<ValueId, ValueId>> parallel_copy(const BlockId from, const BlockId to) const{
+        const IrBlock& target = m_prog.blocks[to];
+        std::vector<std::pair<ValueId, ValueId>> pending;
+        if (!target.phis.empty()) {
+            const auto pred = std::ranges::find(target.preds, from) - target.preds.begin();
+            for (const IrPhi& phi : target.phis) {
+                if (phi.dst != phi.args[pred]) {
+                    pending.emplace_back(phi.dst, phi.args[pred]);
+                }
+            }
+        }
+        std::vector<std::pair<ValueId, ValueId>> ordered;
+        while (!pending.empty()) {
+            const auto ready = std::ranges::find_if(pending, [&](const auto& copy){
+                return std::ranges::none_of(pending, [&](const auto& other){
+                    return other.second == copy.first;
+                });
+            });
+            if (ready != pending.end()) {
+                ordered.push_back(*ready);
+                pending.erase(ready);
+                continue;
+            }
+            const ValueId blocked = pending.front().first;
+            ordered.emplace_back(temp(), blocked);
+            for (auto& [dst, src] : pending) {
+                if (src == blocked) {
+                    src = temp();
+                }
+            }
+        }
+        return ordered;
+    }
+};
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "driver.h"
+#include "thread_pool.h"
+
+// Command line front end, shared by the hydro executable and the compile daemon
+namespace cli {
+
+enum class StatsFormat{
+    none,
+    text,
+    json
+};
+
+struct Job{
+    std::string input; // as given on the command line, for diagnostics
+    std::string input_path;
+    std::string output_path;
+    CompileResult result{};
+    CompileStats stats{};
+    std::string error{};
+    bool failed = false;
+};
+
+inline void usage(std::ostream& err){
+    err << "Incorrect Usage: " << std::endl;
+    err << "Usage: hydro [--asm] [--ir] [--stats[=json]] [-j N] <input.hy | -> [-o output] ..." << std::endl;
+    err << "       hydro --run[=vm] [--asm] [--ir] [--stats[=json]] <input.hy | ->" << std::endl;
+    err << "       hydro --serve [socket]" << std::endl;
+    err << "       hydro-client --open <input.hy> | --close <input.hy>" << std::endl;
+    err << "       hydro-client --edit <input.hy> <offset> <removed> <text>" << std::endl;
+}
+
+// Without -o, a single input keeps writing to `out`; in a batch each input gets its own executable
+// next to it, named after it without the `.hy`
+inline std::string default_output(const std::string& input, const bool batch){
+    if (!batch) {
+        return "out";
+    }
+    if (input.size() > 3 && input.ends_with(".hy")) {
+        return input.substr(0, input.size() - 3);
+    }
+    return input + ".out";
+}
+
+inline void report_stats(std::ostream& err, const Job& job, const StatsFormat stats){
+    if (job.failed || stats == StatsFormat::none) {
+        return;
+    }
+    if (stats == StatsFormat::json) {
+        write_stats_json(err, job.input, job.stats);
+    }
+    else {
+        write_stats(err, job.input, job.stats);
+    }
+}
+
+inline void run_job(Job& job, const CompileOptions& options, const StatsFormat stats){
+    try {
+        job.result = compile_file(job.input_path, job.output_path, options,
+                                  stats == StatsFormat::none ? nullptr : &job.stats);
+    }
+    catch (const CompileError& e) {
+        job.error = e.what();
+        job.failed = true;
+    }
+    catch (const std::exception& e) {
+        job.error = std::string("[Internal Error] ") + e.what();
+        job.failed = true;
+    }
+}
+
+// --run: the program's exit code becomes hydro's, and a program killed by a signal exits with 128 plus
+// the signal number, the way a shell reports it
+inline int run_one(Job& job, const CompileOptions& options, const Engine engine, const StatsFormat stats,
+                   std::ostream& err){
+    RunResult result{};
+    try {
+        result = run_file(job.input_path, job.output_path, options, engine,
+                          stats == StatsFormat::none ? nullptr : &job.stats);
+    }
+    catch (const CompileError& e) {
+        err << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    catch (const std::exception& e) {
+        err << "[Internal Error] " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    report_stats(err, job, stats);
+    if (result.signal != 0) {
+        err << "[Runtime Error] " << strsignal(result.signal) << std::endl;
+        return 128 + result.signal;
+    }
+    return result.exit_code;
+}
+
+// Runs one hydro command line (without the program name) and returns its exit status. Relative paths
+// are taken from `cwd`, or from the process's working directory if it's empty, and diagnostics go to
+// `err`. When `pool` is given, which other threads may be using too, every compile runs on it,
+// including a single file and its parallel lexing; otherwise a batch runs on a pool made for this
+// command, and a single file on the calling thread.
+inline int run(const std::vector<std::string>& args, const std::string& cwd, std::ostream& err,
+               ThreadPool* pool = nullptr){
+    CompileOptions options;
+    StatsFormat stats = StatsFormat::none;
+    std::optional<Engine> engine;
+    size_t threads = std::thread::hardware_concurrency();
+    std::vector<Job> jobs;
+    std::vector<bool> has_output;
+    for (size_t i = 0; i < args.size(); i++) {
+        const std::string_view arg(args[i]);
+        if (arg == "--asm") {
+            options.emit_asm = true;
+        }
+        else if (arg == "--ir") {
+            options.emit_ir = true;
+        }
+        else if (arg == "--run") {
+            engine = Engine::jit;
+        }
+        else if (arg == "--run=vm") {
+            engine = Engine::vm;
+        }
+        else if (arg == "--stats") {
+            stats = StatsFormat::text;
+        }
+        else if (arg == "--stats=json") {
+            stats = StatsFormat::json;
+        }
+        else if (arg == "-j" && i + 1 < args.size()) {
+            threads = std::strtoul(args[++i].c_str(), nullptr, 10);
+        }
+        else if (arg == "-o" && i + 1 < args.size() && !jobs.empty() && !has_output.back()) {
+            jobs.back().output_path = args[++i];
+            has_output.back() = true;
+        }
+        else if (arg.size() > 1 && arg.starts_with('-')) {
+            jobs.clear();
+            break;
+        }
+        else {
+            jobs.push_back({.input = std::string(arg), .input_path = {}, .output_path = {}});
+            has_output.push_back(false);
+        }
+    }
+
+    if (jobs.empty() || (engine.has_value() && jobs.size() > 1)) {
+        usage(err);
+        return EXIT_FAILURE;
+    }
+
+    const bool batch = jobs.size() > 1;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        Job& job = jobs[i];
+        if (!has_output[i]) {
+            job.output_path = default_output(job.input, batch);
+        }
+        job.input_path = job.input;
+        if (!cwd.empty()) {
+            if (job.input_path != "-") {
+                job.input_path = std::filesystem::path(cwd) / job.input_path;
+            }
+            job.output_path = std::filesystem::path(cwd) / job.output_path;
+        }
+    }
+
+    // A batch keeps its threads busy with whole files; a single file can use them to lex
+    if (!batch) {
+        options.lex_threads = pool != nullptr ? pool->size() : threads;
+        options.pool = pool;
+    }
+    if (engine.has_value()) {
+        return run_one(jobs[0], options, engine.value(), stats, err);
+    }
+    if (!batch) {
+        // On a given pool, the file is compiled by a worker, whose interner is still warm from the last
+        if (pool != nullptr) {
+            pool->run_batch(1, [&jobs, &options, stats](size_t){ run_job(jobs[0], options, stats); });
+        }
+        else {
+            run_job(jobs[0], options, stats);
+        }
+        if (jobs[0].failed) {
+            err << jobs[0].error << std::endl;
+            return EXIT_FAILURE;
+        }
+        report_stats(err, jobs[0], stats);
+        return EXIT_SUCCESS;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<ThreadPool> own_pool;
+    if (pool == nullptr) {
+        own_pool = std::make_unique<ThreadPool>(std::min(threads, jobs.size()));
+        pool = own_pool.get();
+    }
+    pool->run_batch(jobs.size(), [&jobs, &options, stats](const size_t i){ run_job(jobs[i], options, stats); });
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+    size_t failed = 0;
+    size_t source_bytes = 0;
+    size_t code_bytes = 0;
+    for (const Job& job : jobs) {
+        if (job.failed) {
+            err << job.input << ": " << job.error << std::endl;
+            failed++;
+        }
+        else {
+            report_stats(err, job, stats);
+            source_bytes += job.result.source_bytes;
+            code_bytes += job.result.code_bytes;
+        }
+    }
+    err << "Compiled " << jobs.size() - failed << "/" << jobs.size() << " files (" << failed
+        << " failed), " << source_bytes << " source bytes -> " << code_bytes << " code bytes in "
+        << elapsed.count() << " ms on " << pool->size() << " threads" << std::endl;
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}
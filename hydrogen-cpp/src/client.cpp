@@ -0,0 +1,70 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "./protocol.h"
+
+// Thin front end for `hydro --serve`: takes the same arguments as hydro, hands them to the daemon
+// with the current directory, and prints whatever comes back and exits with its status. The socket is
+// $HYDRO_SOCKET, or the daemon's default.
+int main(int argc, char* argv[]){
+    std::vector<std::string> args(argv + 1, argv + argc);
+    // The text of an --edit is taken as it is, even when it's a lone "-"
+    const bool edit = !args.empty() && args[0] == "--edit";
+    for (const std::string& arg : args) {
+        if (arg == "-" && !edit) {
+            std::cerr << "[Client Error] The daemon can't read this process's stdin; use hydro directly" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    const std::string socket_path = protocol::default_socket_path();
+    const std::optional<sockaddr_un> addr = protocol::socket_address(socket_path);
+    if (!addr.has_value()) {
+        std::cerr << "[Client Error] Socket path too long: " << socket_path << std::endl;
+        return EXIT_FAILURE;
+    }
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<const sockaddr*>(&addr.value()), sizeof(sockaddr_un)) < 0) {
+        std::cerr << "[Client Error] Could not connect to " << socket_path << ": " << std::strerror(errno)
+                  << " (is `hydro --serve` running?)" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // Anyone could have put a socket at the path first; it is only the daemon if it runs as this user
+    ucred peer{};
+    socklen_t peer_size = sizeof(peer);
+    if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size) != 0 || peer.uid != ::geteuid()) {
+        std::cerr << "[Client Error] " << socket_path << " is not served by this user's daemon" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    char cwd[4096];
+    if (::getcwd(cwd, sizeof(cwd)) == nullptr) {
+        std::cerr << "[Client Error] Could not get the working directory: " << std::strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::optional<protocol::Response> response;
+    if (protocol::write_frame(fd, protocol::encode_request(cwd, args))) {
+        if (const std::optional<std::string> payload = protocol::read_frame(fd)) {
+            response = protocol::decode_response(payload.value());
+        }
+    }
+    ::close(fd);
+    if (!response.has_value()) {
+        std::cerr << "[Client Error] Lost connection to " << socket_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cerr << response->output;
+    return response->status;
+}
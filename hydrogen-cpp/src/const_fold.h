@@ -0,0 +1,308 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "ast.h"
+
+// Folds constant subexpressions, propagates known values of variables through let/assign and the
+// arms of if/elif/else, and deletes branches and statements that can never run. A while loop forgets
+// what it knows about every variable its body assigns, since any iteration may have changed them.
+// Variables whose every read was replaced by a constant have their stores removed afterwards.
+class ConstFolder{
+public:
+    explicit ConstFolder(Ast& ast)
+        : m_ast(ast),
+          m_decls(ast.slot_count),
+          m_env_pos(ast.slot_count)
+    {}
+
+    void fold_prog(){
+        fold_stmts(m_ast.root);
+        sweep_stmts(m_ast.root);
+    }
+
+private:
+    struct Binding{
+        uint32_t slot;
+        std::optional<uint64_t> value;
+    };
+
+    struct Decl{
+        size_t reads = 0;
+        bool literal_stores = true;
+        bool declared = false;
+    };
+
+    Ast& m_ast;
+    std::vector<Binding> m_env{};
+    std::vector<size_t> m_scopes{};
+    std::vector<Decl> m_decls;
+    // Where each variable in scope sits in m_env
+    std::vector<uint32_t> m_env_pos;
+    ExprWalker m_walker{};
+    // Values of the operands fold_expr has folded but not yet used
+    std::vector<std::optional<uint64_t>> m_operands{};
+
+    Binding& lookup(const uint32_t slot){
+        return m_env[m_env_pos[slot]];
+    }
+
+    std::optional<uint64_t> fold_expr(const ExprId expr){
+        for (const ExprId node : m_walker.postorder(m_ast, expr)) {
+            m_operands.push_back(fold_node(node));
+        }
+        const std::optional<uint64_t> value = m_operands.back();
+        m_operands.clear();
+        return value;
+    }
+
+    // Folds one node whose operands' values are on top of m_operands, popping them
+    std::optional<uint64_t> fold_node(const ExprId expr){
+        switch (m_ast.kind(expr)) {
+        case ExprKind::int_lit:
+            return m_ast.int_lit(expr);
+        case ExprKind::ident: {
+            const Binding& binding = lookup(m_ast.slot(expr));
+            if (binding.value.has_value()) {
+                m_ast.set_int_lit(expr, binding.value.value());
+                return binding.value;
+            }
+            m_decls[binding.slot].reads++;
+            return {};
+        }
+        default:
+            break;
+        }
+
+        const std::optional<uint64_t> rhs = m_operands.back();
+        m_operands.pop_back();
+        const std::optional<uint64_t> lhs = m_operands.back();
+        m_operands.pop_back();
+        if (!lhs.has_value() || !rhs.has_value()) {
+            return {};
+        }
+        uint64_t value;
+        switch (m_ast.kind(expr)) {
+        case ExprKind::add:
+            value = *lhs + *rhs;
+            break;
+        case ExprKind::sub:
+            value = *lhs - *rhs;
+            break;
+        case ExprKind::mul:
+            value = *lhs * *rhs;
+            break;
+        default:
+            // Division by zero is left in place so it still faults at run time
+            if (*rhs == 0) return {};
+            value = *lhs / *rhs;
+            break;
+        }
+        m_ast.set_int_lit(expr, value);
+        return value;
+    }
+
+    void begin_scope(){
+        m_scopes.push_back(m_env.size());
+    }
+
+    void end_scope(){
+        m_env.resize(m_scopes.back());
+        m_scopes.pop_back();
+    }
+
+    // Returns true when the statements always reach an exit
+    bool fold_scope(const BodyId body){
+        begin_scope();
+        const bool terminates = fold_stmts(body);
+        end_scope();
+        return terminates;
+    }
+
+    bool fold_stmts(const BodyId body){
+        const std::span<StmtId> stmts = m_ast.stmts(body);
+        size_t kept = 0;
+        bool terminates = false;
+        for (const StmtId stmt : stmts) {
+            const std::optional<bool> result = fold_stmt(stmt);
+            if (!result.has_value()) continue;
+            stmts[kept++] = stmt;
+            if (result.value()) {
+                terminates = true;
+                break;
+            }
+        }
+        m_ast.truncate(body, kept);
+        return terminates;
+    }
+
+    // Returns whether the statement always exits, or nullopt if it should be deleted
+    std::optional<bool> fold_stmt(const StmtId stmt){
+        switch (m_ast.kind(stmt)) {
+        case StmtKind::exit:
+            fold_expr(m_ast.exit_expr(stmt));
+            return true;
+        case StmtKind::let: {
+            const uint32_t slot = m_ast.store_slot(stmt);
+            const std::optional<uint64_t> value = fold_expr(m_ast.store(stmt).expr);
+            m_decls[slot].declared = true;
+            m_decls[slot].literal_stores &= value.has_value();
+            m_env_pos[slot] = static_cast<uint32_t>(m_env.size());
+            m_env.push_back({.slot = slot, .value = value});
+            return false;
+        }
+        case StmtKind::assign: {
+            const uint32_t slot = m_ast.store_slot(stmt);
+            const std::optional<uint64_t> value = fold_expr(m_ast.store(stmt).expr);
+            lookup(slot).value = value;
+            m_decls[slot].literal_stores &= value.has_value();
+            return false;
+        }
+        case StmtKind::scope:
+            return fold_scope(m_ast.scope_body(stmt));
+        case StmtKind::if_:
+            return fold_if(stmt);
+        case StmtKind::while_:
+            return fold_while(stmt);
+        }
+        return false;
+    }
+
+    std::optional<bool> fold_while(const StmtId stmt){
+        const WhileStmt& loop = m_ast.while_stmt(stmt);
+        forget_assigned(loop.body);
+        const std::optional<uint64_t> cond = fold_expr(loop.cond);
+        if (cond == 0u) {
+            return {};
+        }
+        const std::vector<Binding> before = m_env;
+        fold_scope(loop.body);
+        m_env = before;
+        // Without a break statement, a loop whose condition is always true can only be left by exiting
+        return cond.has_value();
+    }
+
+    // Every variable from outside the body that the body assigns, at any depth, becomes unknown
+    void forget_assigned(const BodyId body){
+        for (const StmtId stmt : m_ast.stmts(body)) {
+            switch (m_ast.kind(stmt)) {
+            case StmtKind::assign: {
+                const uint32_t slot = m_ast.store_slot(stmt);
+                // Variables the body declares itself haven't been reached yet
+                if (m_decls[slot].declared) {
+                    lookup(slot).value.reset();
+                }
+                break;
+            }
+            case StmtKind::scope:
+                forget_assigned(m_ast.scope_body(stmt));
+                break;
+            case StmtKind::if_:
+                for (const Arm& arm : m_ast.if_arms(stmt)) {
+                    forget_assigned(arm.body);
+                }
+                break;
+            case StmtKind::while_:
+                forget_assigned(m_ast.while_stmt(stmt).body);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    std::optional<bool> fold_if(const StmtId stmt){
+        // Arms whose condition is known false are dropped in place, and an arm whose condition is
+        // known true becomes the else and ends the chain
+        const std::span<Arm> arms = m_ast.if_arms(stmt);
+        size_t kept = 0;
+        bool has_else = false;
+        for (const Arm& arm : arms) {
+            const std::optional<uint64_t> value = arm.cond != no_expr ? fold_expr(arm.cond) : std::optional<uint64_t>{1};
+            if (value.has_value() && value.value() == 0) continue;
+            has_else = value.has_value();
+            arms[kept++] = {.cond = has_else ? no_expr : arm.cond, .body = arm.body};
+            if (has_else) break;
+        }
+
+        if (kept == 0) {
+            return {};
+        }
+
+        // Every arm starts from the same environment, and a variable stays known after the if only
+        // when every arm that falls through agrees on its value
+        const std::vector<Binding> before = m_env;
+        std::optional<std::vector<Binding>> merged;
+        bool terminates = has_else;
+        for (const Arm& arm : arms.first(kept)) {
+            m_env = before;
+            if (fold_scope(arm.body)) continue;
+            terminates = false;
+            merge(merged, m_env);
+        }
+        if (!has_else) {
+            merge(merged, before);
+        }
+        m_env = merged.has_value() ? std::move(merged.value()) : before;
+
+        if (arms.front().cond == no_expr) {
+            m_ast.set_scope(stmt, arms.front().body);
+        }
+        else {
+            m_ast.if_stmt(stmt).arm_count = static_cast<uint32_t>(kept);
+        }
+        return terminates;
+    }
+
+    static void merge(std::optional<std::vector<Binding>>& merged, const std::vector<Binding>& env){
+        if (!merged.has_value()) {
+            merged = env;
+            return;
+        }
+        for (size_t i = 0; i < env.size(); i++) {
+            if (merged.value()[i].value != env[i].value) {
+                merged.value()[i].value.reset();
+            }
+        }
+    }
+
+    [[nodiscard]] bool removable(const uint32_t slot) const{
+        return m_decls[slot].declared && m_decls[slot].reads == 0 && m_decls[slot].literal_stores;
+    }
+
+    void sweep_stmts(const BodyId body){
+        const std::span<StmtId> stmts = m_ast.stmts(body);
+        size_t kept = 0;
+        for (const StmtId stmt : stmts) {
+            if (!sweep_stmt(stmt)) {
+                stmts[kept++] = stmt;
+            }
+        }
+        m_ast.truncate(body, kept);
+    }
+
+    // Returns true when the statement no longer does anything
+    bool sweep_stmt(const StmtId stmt){
+        switch (m_ast.kind(stmt)) {
+        case StmtKind::let:
+        case StmtKind::assign:
+            return removable(m_ast.store_slot(stmt));
+        case StmtKind::scope:
+            sweep_stmts(m_ast.scope_body(stmt));
+            return m_ast.stmts(m_ast.scope_body(stmt)).empty();
+        case StmtKind::if_:
+            for (const Arm& arm : m_ast.if_arms(stmt)) {
+                sweep_stmts(arm.body);
+            }
+            return false;
+        case StmtKind::while_:
+            sweep_stmts(m_ast.while_stmt(stmt).body);
+            return false;
+        case StmtKind::exit:
+            return false;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "ast.h"
+
+// Backward liveness over scopes, if/elif/else and while loops, where a loop is iterated until what is
+// live at its head stops growing. A let or assignment whose variable is dead afterwards is dropped, as
+// long as its expression cannot fault. A dead let that later assignments still refer
+// to keeps its declaration but loses its initializer.
+class DeadStoreElim{
+public:
+    explicit DeadStoreElim(Ast& ast)
+        : m_ast(ast),
+          m_dead(ast.stmt_kinds.size())
+    {}
+
+    void run(){
+        std::vector<bool> live(m_ast.slot_count);
+        live_stmts(m_ast.root, live);
+        m_refs.assign(m_ast.slot_count, 0);
+        count_stmts(m_ast.root);
+        sweep_stmts(m_ast.root);
+    }
+
+private:
+    Ast& m_ast;
+    std::vector<bool> m_dead;
+    std::vector<size_t> m_refs{};
+    ExprWalker m_walker{};
+
+    template <typename Fn>
+    void for_each_ident(const ExprId expr, Fn&& fn){
+        for (const ExprId node : m_walker.postorder(m_ast, expr)) {
+            if (m_ast.kind(node) == ExprKind::ident) {
+                fn(m_ast.slot(node));
+            }
+        }
+    }
+
+    // Only division by anything other than a non-zero literal can fault
+    [[nodiscard]] bool may_fault(const ExprId expr){
+        for (const ExprId node : m_walker.postorder(m_ast, expr)) {
+            if (m_ast.kind(node) != ExprKind::div) continue;
+            const ExprId divisor = m_ast.bin(node).rhs;
+            if (m_ast.kind(divisor) != ExprKind::int_lit || m_ast.int_lit(divisor) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool has_else(const std::span<const Arm> arms){
+        return arms.back().cond == no_expr;
+    }
+
+    void use_expr(const ExprId expr, std::vector<bool>& live){
+        for_each_ident(expr, [&](const uint32_t slot){
+            live[slot] = true;
+        });
+    }
+
+    // Handles a let or assignment
+    void live_store(const StmtId stmt, std::vector<bool>& live){
+        const uint32_t slot = m_ast.store_slot(stmt);
+        const ExprId expr = m_ast.store(stmt).expr;
+        // Loop bodies are visited more than once, and only the last visit counts
+        m_dead[stmt.index] = !live[slot] && !may_fault(expr);
+        if (m_dead[stmt.index]) {
+            return;
+        }
+        live[slot] = false;
+        use_expr(expr, live);
+    }
+
+    // Turns `live` from the set live after the statements into the set live before them
+    void live_stmts(const BodyId body, std::vector<bool>& live){
+        const std::span<const StmtId> stmts = m_ast.stmts(body);
+        for (auto it = stmts.rbegin(); it != stmts.rend(); ++it) {
+            const StmtId stmt = *it;
+            switch (m_ast.kind(stmt)) {
+            case StmtKind::exit:
+                live.assign(live.size(), false);
+                use_expr(m_ast.exit_expr(stmt), live);
+                break;
+            case StmtKind::let:
+            case StmtKind::assign:
+                live_store(stmt, live);
+                break;
+            case StmtKind::scope:
+                live_stmts(m_ast.scope_body(stmt), live);
+                break;
+            case StmtKind::if_: {
+                const std::span<const Arm> arms = m_ast.if_arms(stmt);
+                const std::vector<bool> after = live;
+                std::vector<bool> before(live.size());
+                if (!has_else(arms)) {
+                    before = after;
+                }
+                for (const Arm& arm : arms) {
+                    std::vector<bool> arm_live = after;
+                    live_stmts(arm.body, arm_live);
+                    if (arm.cond != no_expr) {
+                        use_expr(arm.cond, arm_live);
+                    }
+                    for (size_t i = 0; i < arm_live.size(); i++) {
+                        if (arm_live[i]) before[i] = true;
+                    }
+                }
+                live = std::move(before);
+                break;
+            }
+            case StmtKind::while_:
+                live_while(stmt, live);
+                break;
+            }
+        }
+    }
+
+    // Live at the head is what the condition reads, what is live after the loop, and what the body
+    // needs when it runs with the head as its successor
+    void live_while(const StmtId stmt, std::vector<bool>& live){
+        const WhileStmt& loop = m_ast.while_stmt(stmt);
+        use_expr(loop.cond, live);
+        while (true) {
+            std::vector<bool> body_live = live;
+            live_stmts(loop.body, body_live);
+            bool grew = false;
+            for (size_t i = 0; i < live.size(); i++) {
+                if (body_live[i] && !live[i]) {
+                    live[i] = true;
+                    grew = true;
+                }
+            }
+            if (!grew) {
+                break;
+            }
+        }
+    }
+
+    void count_expr(const ExprId expr){
+        for_each_ident(expr, [&](const uint32_t slot){
+            m_refs[slot]++;
+        });
+    }
+
+    void count_stmts(const BodyId body){
+        for (const StmtId stmt : m_ast.stmts(body)) {
+            if (m_dead[stmt.index]) continue;
+            switch (m_ast.kind(stmt)) {
+            case StmtKind::exit:
+                count_expr(m_ast.exit_expr(stmt));
+                break;
+            case StmtKind::let:
+                count_expr(m_ast.store(stmt).expr);
+                break;
+            case StmtKind::assign:
+                m_refs[m_ast.store_slot(stmt)]++;
+                count_expr(m_ast.store(stmt).expr);
+                break;
+            case StmtKind::scope:
+                count_stmts(m_ast.scope_body(stmt));
+                break;
+            case StmtKind::if_:
+                for (const Arm& arm : m_ast.if_arms(stmt)) {
+                    if (arm.cond != no_expr) {
+                        count_expr(arm.cond);
+                    }
+                    count_stmts(arm.body);
+                }
+                break;
+            case StmtKind::while_:
+                count_expr(m_ast.while_stmt(stmt).cond);
+                count_stmts(m_ast.while_stmt(stmt).body);
+                break;
+            }
+        }
+    }
+
+    void sweep_stmts(const BodyId body){
+        const std::span<StmtId> stmts = m_ast.stmts(body);
+        size_t kept = 0;
+        for (const StmtId stmt : stmts) {
+            if (!sweep_stmt(stmt)) {
+                stmts[kept++] = stmt;
+            }
+        }
+        m_ast.truncate(body, kept);
+    }
+
+    // Returns true when the statement should be removed
+    bool sweep_stmt(const StmtId stmt){
+        switch (m_ast.kind(stmt)) {
+        case StmtKind::scope:
+            sweep_stmts(m_ast.scope_body(stmt));
+            return m_ast.stmts(m_ast.scope_body(stmt)).empty();
+        case StmtKind::if_:
+            for (const Arm& arm : m_ast.if_arms(stmt)) {
+                sweep_stmts(arm.body);
+            }
+            return false;
+        case StmtKind::while_:
+            sweep_stmts(m_ast.while_stmt(stmt).body);
+            return false;
+        case StmtKind::let:
+            if (m_dead[stmt.index] && m_refs[m_ast.store_slot(stmt)] > 0) {
+                m_ast.set_int_lit(m_ast.store(stmt).expr, 0);
+                return false;
+            }
+            return m_dead[stmt.index];
+        default:
+            return m_dead[stmt.index];
+        }
+    }
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <csignal>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "bytecode.h"
+#include "const_fold.h"
+#include "dead_store.h"
+#include "elf_writer.h"
+#include "encoder.h"
+#include "error.h"
+#include "generator.h"
+#include "interner.h"
+#include "ir_builder.h"
+#include "ir_opt.h"
+#include "jit.h"
+#include "out_buffer.h"
+#include "parallel_lexer.h"
+#include "parser.h"
+#include "peephole.h"
+#include "resolver.h"
+#include "source.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "tokenizer.h"
+#include "vm.h"
+
+struct CompileOptions{
+    bool emit_asm = false;
+    bool emit_ir = false;
+    size_t lex_threads = 1; // for a large file, lexed up front by ParallelLexer when above 1
+    ThreadPool* pool = nullptr; // for ParallelLexer, instead of a pool made for each file
+};
+
+struct CompileResult{
+    size_t source_bytes;
+    size_t code_bytes;
+};
+
+// Each thread keeps its interner, with its table and arena, from one file to the next, so a
+// long-running process (a batch worker or the daemon) stops allocating for it once it has warmed up
+inline Interner& thread_interner(){
+    static thread_local Interner interner;
+    interner.clear();
+    return interner;
+}
+
+struct CompiledIr{
+    size_t source_bytes;
+    IrProg ir;
+};
+
+struct CompiledCode{
+    size_t source_bytes;
+    std::vector<uint8_t> code;
+};
+
+// How --run executes a program: as native code mapped into hydro, or on the bytecode VM
+enum class Engine : uint8_t{
+    jit,
+    vm
+};
+
+struct RunResult{
+    int exit_code;
+    int signal; // the signal that stopped the program, or 0 if it exited
+};
+
+// Runs the front end and the IR passes for one file (writing `<output_path>.ir` when asked for). All
+// state is on this call's stack or thread-local, so separate files can be compiled on separate
+// threads. Failures are thrown as CompileError.
+//
+// With `stats`, each phase is timed into it along with what the phase produced. Unless the file is
+// lexed in parallel, parsing lexes as it goes, so the lex phase is an extra tokenizer pass that only
+// runs to be measured.
+inline CompiledIr compile_ir(const std::string& input_path, const std::string& output_path,
+                             const CompileOptions& options, CompileStats* stats){
+    PhaseTimer timer(stats);
+
+    // Tokens point into the source, so it has to outlive everything below
+    const SourceFile source(input_path);
+    timer.lap("read");
+
+    Interner& interner = thread_interner();
+    std::optional<Ast> prog;
+    if (options.lex_threads > 1 && source.text().size() >= 2 * ParallelLexer::min_chunk_bytes) {
+        std::vector<TokenStream> tokens = ParallelLexer(source.text(), interner, options.lex_threads, options.pool).lex();
+        if (stats != nullptr) {
+            for (const TokenStream& stream : tokens) {
+                stats->tokens += stream.tokens.size();
+            }
+        }
+        timer.lap("lex");
+        prog = Parser(std::move(tokens)).parse_prog();
+    }
+    else {
+        if (stats != nullptr) {
+            Tokenizer tokenizer(source.text(), interner);
+            while (tokenizer.next().has_value()) {
+                stats->tokens++;
+            }
+            timer.lap("lex");
+        }
+        prog = Parser(Tokenizer(source.text(), interner)).parse_prog();
+    }
+    timer.lap("parse");
+
+    if (!prog.has_value()) {
+        compile_error("Invalid program");
+    }
+    if (stats != nullptr) {
+        stats->count_nodes(prog.value());
+    }
+
+    Resolver(prog.value(), interner).run();
+    timer.lap("resolve");
+    ConstFolder(prog.value()).fold_prog();
+    DeadStoreElim(prog.value()).run();
+    timer.lap("fold");
+
+    IrProg ir = IrBuilder(prog.value()).build();
+    timer.lap("ir_build");
+    IrOptimizer(ir).run();
+    timer.lap("ir_opt");
+
+    if (options.emit_ir) {
+        OutBuffer file(output_path + ".ir");
+        write_ir(file, ir);
+        file.flush();
+        timer.lap("emit_ir");
+    }
+    if (stats != nullptr) {
+        stats->source_bytes = source.text().size();
+        stats->symbols = interner.size();
+        stats->arena = interner.arena_stats();
+        for (const IrBlock& block : ir.blocks) {
+            stats->ir_insts += block.phis.size() + block.insts.size() + 1;
+        }
+    }
+    return {.source_bytes = source.text().size(), .ir = std::move(ir)};
+}
+
+// Continues compile_ir() down to machine code for `target`, writing `<output_path>.asm` when asked for
+inline CompiledCode compile_code(const std::string& input_path, const std::string& output_path,
+                                 const CompileOptions& options, const Target target, CompileStats* stats){
+    CompiledIr compiled = compile_ir(input_path, output_path, options, stats);
+    PhaseTimer timer(stats);
+
+    Generator generator(std::move(compiled.ir), target);
+    std::vector<Instr> instrs = generator.gen_prog();
+    if (target == Target::jit) {
+        JitProgram::add_frame(instrs);
+    }
+    timer.lap("codegen");
+    instrs = Peephole(std::move(instrs)).run();
+    timer.lap("peephole");
+
+    if (options.emit_asm) {
+        OutBuffer file(output_path + ".asm");
+        write_asm(file, instrs);
+        file.flush();
+        timer.lap("emit_asm");
+    }
+
+    // The encoder is hydro's own assembler
+    std::vector<uint8_t> code = Encoder(instrs).encode();
+    timer.lap("assemble");
+
+    if (stats != nullptr) {
+        stats->instrs = instrs.size();
+        stats->frame_bytes = generator.frame_bytes();
+        stats->code_bytes = code.size();
+    }
+    return {.source_bytes = compiled.source_bytes, .code = std::move(code)};
+}
+
+// Compiles one file and writes the executable to `output_path`
+inline CompileResult compile_file(const std::string& input_path, const std::string& output_path,
+                                  const CompileOptions& options, CompileStats* stats = nullptr){
+    const CompiledCode compiled = compile_code(input_path, output_path, options, Target::elf, stats);
+    PhaseTimer timer(stats);
+    ElfWriter(compiled.code).write(output_path);
+    timer.lap("link");
+    return {.source_bytes = compiled.source_bytes, .code_bytes = compiled.code.size()};
+}
+
+// Compiles one file and runs it in this process, without writing an executable. `output_path` only
+// names the .asm / .ir files; the VM has no machine code, so it writes no .asm.
+inline RunResult run_file(const std::string& input_path, const std::string& output_path,
+                          const CompileOptions& options, const Engine engine, CompileStats* stats = nullptr){
+    if (engine == Engine::vm) {
+        const CompiledIr compiled = compile_ir(input_path, output_path, options, stats);
+        PhaseTimer timer(stats);
+        const BytecodeProg bytecode = BytecodeBuilder(compiled.ir).build();
+        timer.lap("bytecode");
+        if (stats != nullptr) {
+            stats->instrs = bytecode.instr_count;
+            stats->code_bytes = bytecode.code.size() * sizeof(uint32_t);
+        }
+        const Vm::Result result = Vm(bytecode).run();
+        timer.lap("run");
+        return {.exit_code = result.exit_code, .signal = result.signal};
+    }
+
+    const CompiledCode compiled = compile_code(input_path, output_path, options, Target::jit, stats);
+    PhaseTimer timer(stats);
+    const JitProgram program(compiled.code);
+    timer.lap("load");
+    const JitProgram::Result result = program.run();
+    timer.lap("run");
+    return {.exit_code = result.exit_code, .signal = result.signal};
+}
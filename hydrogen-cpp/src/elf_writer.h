@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <elf.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "out_buffer.h"
+
+// Writes machine code as a static ELF64 executable with a single R+X PT_LOAD segment
+class ElfWriter{
+public:
+    static constexpr uint64_t base_addr = 0x400000;
+
+    explicit ElfWriter(const std::vector<uint8_t>& code): m_code(code){}
+
+    // Streams the headers and then the code to the file, without assembling the image in memory
+    void write(const std::string& path) const{
+        {
+            const Headers headers = make_headers();
+            OutBuffer file(path, 0755);
+            file.write(&headers, sizeof(headers));
+            file.write(m_code.data(), m_code.size());
+            file.flush();
+        }
+        chmod(path.c_str(), 0755);
+    }
+
+private:
+    static constexpr uint64_t code_offset = sizeof(Elf64_Ehdr) + sizeof(Elf64_Phdr);
+
+    struct Headers{
+        Elf64_Ehdr ehdr;
+        Elf64_Phdr phdr;
+    };
+    static_assert(sizeof(Headers) == code_offset);
+
+    [[nodiscard]] Headers make_headers() const{
+        const uint64_t file_size = code_offset + m_code.size();
+
+        Elf64_Ehdr ehdr{};
+        std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+        ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+        ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+        ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+        ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+        ehdr.e_type = ET_EXEC;
+        ehdr.e_machine = EM_X86_64;
+        ehdr.e_version = EV_CURRENT;
+        ehdr.e_entry = base_addr + code_offset;
+        ehdr.e_phoff = sizeof(Elf64_Ehdr);
+        ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+        ehdr.e_phentsize = sizeof(Elf64_Phdr);
+        ehdr.e_phnum = 1;
+
+        Elf64_Phdr phdr{};
+        phdr.p_type = PT_LOAD;
+        phdr.p_flags = PF_R | PF_X;
+        phdr.p_offset = 0;
+        phdr.p_vaddr = base_addr;
+        phdr.p_paddr = base_addr;
+        phdr.p_filesz = file_size;
+        phdr.p_memsz = file_size;
+        phdr.p_align = 0x1000;
+
+        return {.ehdr = ehdr, .phdr = phdr};
+    }
+
+    const std::vector<uint8_t>& m_code;
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "asm.h"
+#include "error.h"
+
+// Encodes the instruction list produced by Generator into x86-64 machine code
+class Encoder{
+public:
+    explicit Encoder(const std::vector<Instr>& instrs): m_instrs(instrs){}
+
+    [[nodiscard]] std::vector<uint8_t> encode(){
+        for (const Instr& instr : m_instrs) {
+            encode_instr(instr);
+        }
+
+        for (const auto& [pos, label] : m_fixups) {
+            if (label >= m_labels.size() || m_labels[label] < 0) {
+                compile_error("[Encoder Error] Undefined label: label" + std::to_string(label));
+            }
+            const auto rel = static_cast<int32_t>(m_labels[label] - static_cast<int64_t>(pos + 4));
+            std::memcpy(m_code.data() + pos, &rel, sizeof(rel));
+        }
+        return std::move(m_code);
+    }
+
+private:
+    const std::vector<Instr>& m_instrs;
+    std::vector<uint8_t> m_code{};
+    std::vector<int64_t> m_labels{};
+    std::vector<std::pair<size_t, size_t>> m_fixups{};
+
+    struct AluOp{
+        uint8_t rm_reg; // op r/m64, r64
+        uint8_t reg_rm; // op r64, r/m64
+        uint8_t digit; // /digit for the 0x81/0x83 immediate forms
+    };
+
+    static bool is_int8(const int64_t value){
+        return value >= INT8_MIN && value <= INT8_MAX;
+    }
+
+    static bool is_int32(const int64_t value){
+        return value >= INT32_MIN && value <= INT32_MAX;
+    }
+
+    static uint8_t low(const Reg reg){
+        return static_cast<uint8_t>(reg) & 7;
+    }
+
+    static bool ext(const Reg reg){
+        return static_cast<uint8_t>(reg) >= 8;
+    }
+
+    [[noreturn]] static void error_operands(const Instr& instr){
+        compile_error("[Encoder Error] Unsupported operands for " + std::string(to_string(instr.op)));
+    }
+
+    void byte(const uint8_t b){
+        m_code.push_back(b);
+    }
+
+    void imm32(const int64_t value){
+        const auto v = static_cast<int32_t>(value);
+        const auto* bytes = reinterpret_cast<const uint8_t*>(&v);
+        m_code.insert(m_code.end(), bytes, bytes + sizeof(v));
+    }
+
+    void imm64(const int64_t value){
+        const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+        m_code.insert(m_code.end(), bytes, bytes + sizeof(value));
+    }
+
+    void rex(const bool w, const uint8_t reg_field, const Reg rm){
+        const uint8_t prefix = 0x40 | (w ? 8 : 0) | (reg_field >= 8 ? 4 : 0) | (ext(rm) ? 1 : 0);
+        if (prefix != 0x40) {
+            byte(prefix);
+        }
+    }
+
+    // Emits [REX] opcode ModRM [SIB] [disp] with reg_field as either a register or an opcode extension
+    void op_rm(const bool w, const std::initializer_list<uint8_t> opcode, const uint8_t reg_field, const Operand& rm){
+        rex(w, reg_field, rm.reg);
+        for (const uint8_t b : opcode) {
+            byte(b);
+        }
+        const uint8_t reg_bits = (reg_field & 7) << 3;
+        if (rm.kind == Operand::Kind::reg) {
+            byte(0xC0 | reg_bits | low(rm.reg));
+            return;
+        }
+
+        const int64_t disp = rm.imm;
+        uint8_t mod;
+        if (disp == 0 && low(rm.reg) != low(Reg::rbp)) {
+            mod = 0x00;
+        }
+        else if (is_int8(disp)) {
+            mod = 0x40;
+        }
+        else {
+            mod = 0x80;
+        }
+        byte(mod | reg_bits | low(rm.reg));
+        if (low(rm.reg) == low(Reg::rsp)) {
+            byte(0x24);
+        }
+        if (mod == 0x40) {
+            byte(static_cast<uint8_t>(disp));
+        }
+        else if (mod == 0x80) {
+            imm32(disp);
+        }
+    }
+
+    void jump(const std::initializer_list<uint8_t> opcode, const Operand& target){
+        for (const uint8_t b : opcode) {
+            byte(b);
+        }
+        m_fixups.emplace_back(m_code.size(), target.imm);
+        imm32(0);
+    }
+
+    void define_label(const size_t id){
+        if (id >= m_labels.size()) {
+            m_labels.resize(id + 1, -1);
+        }
+        m_labels[id] = static_cast<int64_t>(m_code.size());
+    }
+
+    void alu(const Instr& instr, const AluOp& alu_op){
+        const Operand& dst = instr.dst;
+        const Operand& src = instr.src;
+        const bool dst_rm = dst.kind == Operand::Kind::reg || dst.kind == Operand::Kind::mem;
+        if (dst_rm && src.kind == Operand::Kind::reg) {
+            op_rm(true, {alu_op.rm_reg}, static_cast<uint8_t>(src.reg), dst);
+        }
+        else if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::mem) {
+            op_rm(true, {alu_op.reg_rm}, static_cast<uint8_t>(dst.reg), src);
+        }
+        else if (dst_rm && src.kind == Operand::Kind::imm && is_int8(src.imm)) {
+            op_rm(true, {0x83}, alu_op.digit, dst);
+            byte(static_cast<uint8_t>(src.imm));
+        }
+        else if (dst_rm && src.kind == Operand::Kind::imm && is_int32(src.imm)) {
+            op_rm(true, {0x81}, alu_op.digit, dst);
+            imm32(src.imm);
+        }
+        else {
+            error_operands(instr);
+        }
+    }
+
+    void shift(const Instr& instr, const uint8_t digit){
+        if (instr.src.kind != Operand::Kind::imm || instr.src.imm < 0 || instr.src.imm > 63) {
+            error_operands(instr);
+        }
+        op_rm(true, {0xC1}, digit, instr.dst);
+        byte(static_cast<uint8_t>(instr.src.imm));
+    }
+
+    void mov(const Instr& instr){
+        const Operand& dst = instr.dst;
+        const Operand& src = instr.src;
+        if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::imm) {
+            if (src.imm >= 0 && src.imm <= UINT32_MAX) {
+                // mov r32, imm32 zero extends into the full register
+                rex(false, 0, dst.reg);
+                byte(0xB8 + low(dst.reg));
+                imm32(src.imm);
+            }
+            else if (is_int32(src.imm)) {
+                op_rm(true, {0xC7}, 0, dst);
+                imm32(src.imm);
+            }
+            else {
+                rex(true, 0, dst.reg);
+                byte(0xB8 + low(dst.reg));
+                imm64(src.imm);
+            }
+        }
+        else if (dst.kind == Operand::Kind::mem && src.kind == Operand::Kind::imm && is_int32(src.imm)) {
+            op_rm(true, {0xC7}, 0, dst);
+            imm32(src.imm);
+        }
+        else {
+            alu(instr, {.rm_reg = 0x89, .reg_rm = 0x8B, .digit = 0});
+        }
+    }
+
+    void encode_instr(const Instr& instr){
+        switch (instr.op) {
+        case Op::label:
+            define_label(instr.dst.imm);
+            break;
+        case Op::comment:
+            break;
+        case Op::mov:
+            mov(instr);
+            break;
+        case Op::push:
+            if (instr.dst.kind == Operand::Kind::reg) {
+                rex(false, 0, instr.dst.reg);
+                byte(0x50 + low(instr.dst.reg));
+            }
+            else if (instr.dst.kind == Operand::Kind::mem) {
+                op_rm(false, {0xFF}, 6, instr.dst);
+            }
+            else {
+                error_operands(instr);
+            }
+            break;
+        case Op::pop:
+            if (instr.dst.kind == Operand::Kind::reg) {
+                rex(false, 0, instr.dst.reg);
+                byte(0x58 + low(instr.dst.reg));
+            }
+            else if (instr.dst.kind == Operand::Kind::mem) {
+                op_rm(false, {0x8F}, 0, instr.dst);
+            }
+            else {
+                error_operands(instr);
+            }
+            break;
+        case Op::add:
+            alu(instr, {.rm_reg = 0x01, .reg_rm = 0x03, .digit = 0});
+            break;
+        case Op::sub:
+            alu(instr, {.rm_reg = 0x29, .reg_rm = 0x2B, .digit = 5});
+            break;
+        case Op::xor_:
+            alu(instr, {.rm_reg = 0x31, .reg_rm = 0x33, .digit = 6});
+            break;
+        case Op::cmp:
+            alu(instr, {.rm_reg = 0x39, .reg_rm = 0x3B, .digit = 7});
+            break;
+        case Op::shl:
+            shift(instr, 4);
+            break;
+        case Op::shr:
+            shift(instr, 5);
+            break;
+        case Op::mul:
+            op_rm(true, {0xF7}, 4, instr.dst);
+            break;
+        case Op::div:
+            op_rm(true, {0xF7}, 6, instr.dst);
+            break;
+        case Op::je:
+            jump({0x0F, 0x84}, instr.dst);
+            break;
+        case Op::jne:
+            jump({0x0F, 0x85}, instr.dst);
+            break;
+        case Op::jmp:
+            jump({0xE9}, instr.dst);
+            break;
+        case Op::syscall:
+            byte(0x0F);
+            byte(0x05);
+            break;
+        case Op::ret:
+            byte(0xC3);
+            break;
+        }
+    }
+};
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+
+// Every diagnostic that stops compilation of a file is thrown as a CompileError, so a batch can
+// report it against that file and carry on with the others
+struct CompileError : std::runtime_error{
+    using std::runtime_error::runtime_error;
+};
+
+[[noreturn]] inline void compile_error(const std::string& msg){
+    throw CompileError(msg);
+}
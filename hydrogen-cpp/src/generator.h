@@ -1,276 +1,319 @@
 #pragma once
+#include <algorithm>
+#include <bit>
 #include <cassert>
-#include <map>
-#include <bits/ranges_util.h>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "asm.h"
+#include "ir.h"
+#include "regalloc.h"
+
+// Constants for dividing an unsigned 64-bit x by a constant d that isn't a power of two with a
+// multiply-high (Granlund and Montgomery): with t = (x * multiplier) >> 64, the quotient is t >> shift,
+// or (((x - t) >> 1) + t) >> (shift - 1) when `add` is set because the exact multiplier needs 65 bits.
+struct DivMagic{
+    uint64_t multiplier;
+    int shift;
+    bool add;
+};
 
-#include "parser.h"
+inline DivMagic div_magic(const uint64_t d){
+    using u128 = unsigned __int128;
+    const int log = 64 - std::countl_zero(d - 1); // ceil(log2(d))
+    // The smallest shift whose rounded-up multiplier is close enough to 2^(64 + s) / d to be exact
+    for (int s = 0; s <= log && s < 64; s++) {
+        const u128 pow = u128{1} << (64 + s);
+        const u128 m = (pow + d - 1) / d;
+        if (m >> 64 == 0 && m * d - pow <= u128{1} << s) {
+            return {.multiplier = static_cast<uint64_t>(m), .shift = s, .add = false};
+        }
+    }
+    const u128 m = (u128{1} << 64) * ((u128{1} << log) - d) / d + 1;
+    return {.multiplier = static_cast<uint64_t>(m), .shift = log, .add = true};
+}
+
+// How a program's exit is lowered: as the exit syscall of a standalone executable, or, for code run
+// inside hydro, by leaving the exit code in rax and jumping to a final label, where the caller's
+// epilogue goes
+enum class Target : uint8_t{
+    elf,
+    jit
+};
 
+// Emits x86-64 for the SSA IR. Every value keeps its id as a vreg, constants are folded into the
+// instructions that use them, and phis become copies at the end of each predecessor.
 class Generator{
 public:
-    explicit Generator(NodeProg prog): m_prog(std::move(prog)){}
-
-    void gen_term(const NodeTerm* term){
-        struct TermVisitor{
-            Generator& gen;
-
-            void operator()(const NodeTermIntLit* term_int_lit) const{
-                gen.m_output << "    mov rax, " << term_int_lit->int_lit.value.value() << "\n";
-                gen.push("rax");
-            }
-
-            void operator()(const NodeTermIdent* term_ident) const{
-                const auto it = std::find_if(
-                    gen.m_vars.cbegin(),
-                    gen.m_vars.cend(),
-                    [&](const Var& var){
-                        return var.name == term_ident->ident.value.value();
-                    });
-
-                if (it == gen.m_vars.cend()) {
-                    std::cerr << "Undeclared identifier: " << term_ident->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
+    explicit Generator(IrProg prog, const Target target = Target::elf)
+        : m_prog(std::move(prog)),
+          m_target(target),
+          m_consts(m_prog.value_count),
+          m_vreg_count(m_prog.value_count),
+          m_label_count(static_cast<int>(m_prog.blocks.size()))
+    {
+        if (m_target == Target::jit) {
+            m_return_label = create_label();
+        }
+        for (const IrBlock& block : m_prog.blocks) {
+            for (const IrInst& inst : block.insts) {
+                if (inst.op == IrOp::const_) {
+                    m_consts[inst.dst] = inst.imm;
                 }
-                std::stringstream offset;
-                offset << "QWORD [rsp + " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "]";
-                gen.push(offset.str());
-            }
-
-            void operator()(const NodeTermParen* term_paren) const{
-                gen.gen_expr(term_paren->expr);
             }
-        };
-        TermVisitor visitor({.gen = *this});
-        std::visit(visitor, term->var);
+        }
     }
 
-    void gen_bin_expr(const NodeBinExpr* bin_expr){
-        struct BinExprVisitor{
-            Generator& gen;
-
-            void operator()(const NodeBinExprSub* sub) const{
-                gen.gen_expr(sub->rhs);
-                gen.gen_expr(sub->lhs);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    sub rax, rbx\n";
-                gen.push("rax");
+    void gen_inst(const IrInst& inst){
+        switch (inst.op) {
+        case IrOp::const_:
+            break;
+        case IrOp::add:
+            gen_alu(Op::add, inst);
+            break;
+        case IrOp::sub:
+            gen_alu(Op::sub, inst);
+            break;
+        case IrOp::mul:
+            if (m_consts[inst.rhs].has_value() || m_consts[inst.lhs].has_value()) {
+                gen_mul_const(inst);
+                break;
             }
-
-            void operator()(const NodeBinExprAdd* add) const{
-                gen.gen_expr(add->rhs);
-                gen.gen_expr(add->lhs);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    add rax, rbx\n";
-                gen.push("rax");
+            emit(Op::mov, op_reg(Reg::rax), value(inst.lhs));
+            emit(Op::mul, in_reg(value(inst.rhs)));
+            emit(Op::mov, op_vreg(inst.dst), op_reg(Reg::rax));
+            break;
+        case IrOp::div:
+            if (m_consts[inst.rhs].value_or(0) != 0) {
+                gen_div_const(inst);
+                break;
             }
+            emit(Op::mov, op_reg(Reg::rax), value(inst.lhs));
+            emit(Op::xor_, op_reg(Reg::rdx), op_reg(Reg::rdx));
+            emit(Op::div, in_reg(value(inst.rhs)));
+            emit(Op::mov, op_vreg(inst.dst), op_reg(Reg::rax));
+            break;
+        }
+    }
 
-            void operator()(const NodeBinExprMulti* multi) const{
-                gen.gen_expr(multi->rhs);
-                gen.gen_expr(multi->lhs);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    mul rbx\n";
-                gen.push("rax");
+    void gen_term(const BlockId block_id){
+        const IrTerm& term = m_prog.blocks[block_id].term;
+        const BlockId next = block_id + 1;
+        switch (term.kind) {
+        case IrTerm::Kind::exit:
+            if (m_target == Target::jit) {
+                emit(Op::mov, op_reg(Reg::rax), value(term.value));
+                emit(Op::jmp, op_label(m_return_label));
+                break;
             }
-
-            void operator()(const NodeBinExprDiv* div) const{
-                gen.gen_expr(div->rhs);
-                gen.gen_expr(div->lhs);
-                gen.pop("rax");
-                gen.pop("rbx");
-                gen.m_output << "    div rbx\n";
-                gen.push("rax");
+            emit(Op::mov, op_reg(Reg::rdi), value(term.value));
+            emit(Op::mov, op_reg(Reg::rax), op_imm(60));
+            emit(Op::syscall);
+            break;
+        case IrTerm::Kind::jmp:
+            gen_edge(block_id, term.target, next);
+            break;
+        case IrTerm::Kind::br:
+            if (const std::optional<uint64_t> cond = m_consts[term.value]) {
+                gen_edge(block_id, cond.value() != 0 ? term.target : term.else_target, next);
+                break;
             }
-        };
-
-        BinExprVisitor visitor({.gen = *this});
-        std::visit(visitor, bin_expr->var);
-    }
-
-    void gen_expr(const NodeExpr* expr){
-        struct ExprVisitor{
-            Generator& gen;
-
-            void operator()(const NodeTerm* term) const{
-                gen.gen_term(term);
+            emit(Op::cmp, op_vreg(static_cast<int>(term.value)), op_imm(0));
+            if (m_prog.blocks[term.else_target].phis.empty()) {
+                emit(Op::je, op_label(static_cast<int>(term.else_target)));
+                gen_edge(block_id, term.target, next);
             }
-
-            void operator()(const NodeBinExpr* bin_expr) const{
-                gen.gen_bin_expr(bin_expr);
+            else {
+                const int else_edge = create_label();
+                emit(Op::je, op_label(else_edge));
+                gen_edge(block_id, term.target, std::nullopt);
+                emit(Op::label, op_label(else_edge));
+                gen_edge(block_id, term.else_target, next);
             }
-        };
-
-        ExprVisitor visitor{.gen = *this};
-        std::visit(visitor, expr->var);
-    }
-
-    void gen_scope(const NodeScope* scope){
-        begin_scope();
-        for (const NodeStmt* stmt : scope->stmts) {
-            gen_stmt(stmt);
+            break;
         }
-        end_scope();
     }
 
-    void gen_if_pred(const NodeIfPred* pred, const std::string& end_label){
-        struct PredVisitor{
-            Generator& gen;
-            const std::string& end_label;
-
-            void operator()(const NodeIfPredElif* elif) const{
-                gen.m_output << "    ;; elif\n";
-                gen.gen_expr(elif->expr);
-                gen.pop("rax");
-                const std::string label = gen.create_label();
-                gen.m_output << "    cmp rax, 0\n";
-                gen.m_output << "    je " << label << "\n";
-                gen.gen_scope(elif->scope);
-                gen.m_output << "    jmp " << end_label << "\n";
-                gen.m_output << label << ":\n";
-                if (elif->pred.has_value()) {
-                    gen.gen_if_pred(elif->pred.value(), end_label);
-                }
-            }
-
-            void operator()(const NodeIfPredElse* else_) const{
-                gen.m_output << "    ;; else\n";
-                gen.gen_scope(else_->scope);
+    [[nodiscard]] std::vector<Instr> gen_prog(){
+        for (BlockId b = 0; b < m_prog.blocks.size(); b++) {
+            emit(Op::label, op_label(static_cast<int>(b)));
+            for (const IrInst& inst : m_prog.blocks[b].insts) {
+                gen_inst(inst);
             }
-        };
+            gen_term(b);
+        }
+        if (m_target == Target::jit) {
+            emit(Op::label, op_label(m_return_label));
+        }
 
-        PredVisitor visitor{.gen = *this, .end_label = end_label};
-        std::visit(visitor, pred->var);
+        RegAlloc reg_alloc(std::move(m_output), m_vreg_count);
+        std::vector<Instr> instrs = reg_alloc.alloc();
+        m_frame_bytes = reg_alloc.spill_slots() * 8;
+        return instrs;
     }
 
-    void gen_stmt(const NodeStmt* stmt){
-        struct StmtVisitor{
-            Generator& gen;
-
-            void operator()(const NodeStmtExit* stmt_exit) const{
-                gen.m_output << "    ;; exit\n";
-                gen.gen_expr(stmt_exit->expr);
-                gen.m_output << "    mov rax, 60\n";
-                gen.pop("rdi");
-                gen.m_output << "    syscall\n";
-                gen.m_output << "    ;; /exit\n";
-            }
-
-            void operator()(const NodeStmtLet* stmt_let) const{
-                gen.m_output << "    ;; let\n";
-                const auto it = std::find_if(
-                    gen.m_vars.cbegin(),
-                    gen.m_vars.cend(),
-                    [&](const Var& var){
-                        return var.name == stmt_let->ident.value.value();
-                    });
-                if (it != gen.m_vars.cend()) {
-                    std::cerr << "Identifier already used: " << stmt_let->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-
-                gen.m_vars.push_back(
-                    {.name = stmt_let->ident.value.value(), .stack_loc = gen.m_stack_size}
-                );
-                gen.gen_expr(stmt_let->expr);
-                gen.m_output << "    ;; /let\n";
-            }
-
-            void operator()(const NodeScope* stmt_scope) const{
-                gen.m_output << "    ;; scope\n";
-                gen.gen_scope(stmt_scope);
-                gen.m_output << "    ;; /scope\n";
-            }
-
-            void operator()(const NodeStmtIf* stmt_if) const{
-                gen.m_output << "    ;; if\n";
-                gen.gen_expr(stmt_if->expr);
-                gen.pop("rax");
-                const std::string label = gen.create_label();
-                gen.m_output << "    cmp rax, 0\n";
-                gen.m_output << "    je " << label << "\n";
-                gen.gen_scope(stmt_if->scope);
-                if (stmt_if->pred.has_value()) {
-                    const std::string end_label = gen.create_label();
-                    gen.m_output << "    jmp " << end_label << "\n";
-                    gen.m_output << label << ":\n";
-                    gen.gen_if_pred(stmt_if->pred.value(), end_label);
-                    gen.m_output << end_label << ":\n";
-                }
-                else
-                    gen.m_output << label << ":\n";
-                gen.m_output << "    ;; /if\n";
-            }
+    // Stack the program reserves for spilled values, known once gen_prog() has run
+    [[nodiscard]] size_t frame_bytes() const{
+        return m_frame_bytes;
+    }
 
-            void operator()(const NodeStmtAssign* stmt_assign) const{
-                const auto it = std::ranges::find_if(gen.m_vars, [&](const Var& var){
-                    return var.name == stmt_assign->ident.value.value();
-                });
+private:
+    void emit(const Op op, const Operand& dst = {}, const Operand& src = {}){
+        m_output.push_back({.op = op, .dst = dst, .src = src});
+    }
 
-                if (it == gen.m_vars.end()) {
-                    std::cerr << "Undeclared identifier: " << stmt_assign->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                gen.gen_expr(stmt_assign->expr);
-                gen.pop("rax");
-                gen.m_output << "    mov [rsp+ " << (gen.m_stack_size - it->stack_loc - 1) * 8 << "], rax\n";
-            }
-        };
+    Operand create_vreg(){
+        return op_vreg(static_cast<int>(m_vreg_count++));
+    }
 
-        StmtVisitor visitor{.gen = *this};
-        std::visit(visitor, stmt->var);
+    int create_label(){
+        return m_label_count++;
     }
 
-    [[nodiscard]] std::string gen_prog(){
-        m_output << "global _start\n_start:\n";
-        for (const NodeStmt* stmt : m_prog.stmts) {
-            gen_stmt(stmt);
+    [[nodiscard]] Operand value(const ValueId id) const{
+        if (m_consts[id].has_value()) {
+            return op_imm(static_cast<int64_t>(m_consts[id].value()));
         }
-
-        m_output << "    mov rax, 60\n";
-        m_output << "    mov rdi, 0\n";
-        m_output << "    syscall\n";
-        return m_output.str();
+        return op_vreg(static_cast<int>(id));
     }
 
-private:
-    void push(const std::string& reg){
-        m_output << "    push " << reg << "\n";
-        m_stack_size++;
+    // mul/div take a register or memory operand, and ALU immediates are limited to 32 bits
+    Operand in_reg(const Operand& operand, const bool allow_imm32 = false){
+        if (operand.kind != Operand::Kind::imm
+            || (allow_imm32 && operand.imm >= INT32_MIN && operand.imm <= INT32_MAX)) {
+            return operand;
+        }
+        const Operand reg = create_vreg();
+        emit(Op::mov, reg, operand);
+        return reg;
     }
 
-    void pop(const std::string& reg){
-        m_output << "    pop " << reg << "\n";
-        m_stack_size--;
+    void gen_alu(const Op op, const IrInst& inst){
+        const Operand rhs = in_reg(value(inst.rhs), true);
+        emit(Op::mov, op_vreg(inst.dst), value(inst.lhs));
+        emit(op, op_vreg(inst.dst), rhs);
     }
 
-    void begin_scope(){
-        m_scopes.push_back(m_vars.size());
+    // Multiplying by a constant: shifts for powers of two and their neighbours, mul for the rest
+    void gen_mul_const(const IrInst& inst){
+        const bool rhs_const = m_consts[inst.rhs].has_value();
+        const uint64_t c = rhs_const ? m_consts[inst.rhs].value() : m_consts[inst.lhs].value();
+        const ValueId x = rhs_const ? inst.lhs : inst.rhs;
+        const Operand dst = op_vreg(static_cast<int>(inst.dst));
+        if (m_consts[x].has_value()) {
+            emit(Op::mov, dst, op_imm(static_cast<int64_t>(m_consts[x].value() * c)));
+            return;
+        }
+        const Operand src = value(x);
+        if (c == 0) {
+            emit(Op::mov, dst, op_imm(0));
+        }
+        else if (std::has_single_bit(c)) {
+            emit(Op::mov, dst, src);
+            emit(Op::shl, dst, op_imm(std::countr_zero(c)));
+        }
+        else if (std::has_single_bit(c - 1)) {
+            emit(Op::mov, dst, src);
+            emit(Op::shl, dst, op_imm(std::countr_zero(c - 1)));
+            emit(Op::add, dst, src);
+        }
+        else if (c != UINT64_MAX && std::has_single_bit(c + 1)) {
+            emit(Op::mov, dst, src);
+            emit(Op::shl, dst, op_imm(std::countr_zero(c + 1)));
+            emit(Op::sub, dst, src);
+        }
+        else {
+            emit(Op::mov, op_reg(Reg::rax), op_imm(static_cast<int64_t>(c)));
+            emit(Op::mul, src);
+            emit(Op::mov, dst, op_reg(Reg::rax));
+        }
     }
 
-    void end_scope(){
-        const size_t pop_count = m_vars.size() - m_scopes.back();
-        m_output << "    add rsp, " << pop_count * 8 << "\n";
-        m_stack_size -= pop_count;
-        for (int i = 0; i < pop_count; i++) {
-            m_vars.pop_back();
+    // Dividing by a non-zero constant: a shift for powers of two, and a multiply-high by the
+    // reciprocal instead of the much slower div otherwise
+    void gen_div_const(const IrInst& inst){
+        const uint64_t c = m_consts[inst.rhs].value();
+        const Operand dst = op_vreg(static_cast<int>(inst.dst));
+        if (m_consts[inst.lhs].has_value()) {
+            emit(Op::mov, dst, op_imm(static_cast<int64_t>(m_consts[inst.lhs].value() / c)));
+            return;
+        }
+        const Operand src = value(inst.lhs);
+        if (std::has_single_bit(c)) {
+            emit(Op::mov, dst, src);
+            if (c != 1) {
+                emit(Op::shr, dst, op_imm(std::countr_zero(c)));
+            }
+            return;
+        }
+        const DivMagic magic = div_magic(c);
+        emit(Op::mov, op_reg(Reg::rax), op_imm(static_cast<int64_t>(magic.multiplier)));
+        emit(Op::mul, src);
+        if (!magic.add) {
+            emit(Op::mov, dst, op_reg(Reg::rdx));
+            if (magic.shift != 0) {
+                emit(Op::shr, dst, op_imm(magic.shift));
+            }
+            return;
         }
-        m_scopes.pop_back();
+        emit(Op::mov, dst, src);
+        emit(Op::sub, dst, op_reg(Reg::rdx));
+        emit(Op::shr, dst, op_imm(1));
+        emit(Op::add, dst, op_reg(Reg::rdx));
+        emit(Op::shr, dst, op_imm(magic.shift - 1));
     }
 
-    std::string create_label(){
-        return "label" + std::to_string(m_label_count++);
+    // Copies phi arguments for the edge from -> to, then jumps unless `to` is laid out next
+    void gen_edge(const BlockId from, const BlockId to, const std::optional<BlockId> next){
+        const IrBlock& target = m_prog.blocks[to];
+        if (!target.phis.empty()) {
+            const auto pred = std::ranges::find(target.preds, from) - target.preds.begin();
+            std::vector<std::pair<Operand, Operand>> copies;
+            for (const IrPhi& phi : target.phis) {
+                copies.emplace_back(op_vreg(static_cast<int>(phi.dst)), value(phi.args[pred]));
+            }
+            gen_parallel_copy(copies);
+        }
+        if (next != to) {
+            emit(Op::jmp, op_label(static_cast<int>(to)));
+        }
     }
 
-    struct Var{
-        std::string name;
-        size_t stack_loc;
-    };
+    // Phi copies on an edge happen simultaneously, so a copy is only emitted once no other pending
+    // copy still needs to read its destination. Cycles are broken through a temporary.
+    void gen_parallel_copy(std::vector<std::pair<Operand, Operand>> copies){
+        std::erase_if(copies, [](const auto& copy){
+            return copy.first == copy.second;
+        });
+        while (!copies.empty()) {
+            const auto ready = std::ranges::find_if(copies, [&](const auto& copy){
+                return std::ranges::none_of(copies, [&](const auto& other){
+                    return other.second == copy.first;
+                });
+            });
+            if (ready != copies.end()) {
+                emit(Op::mov, ready->first, ready->second);
+                copies.erase(ready);
+                continue;
+            }
+            const Operand blocked = copies.front().first;
+            const Operand temp = create_vreg();
+            emit(Op::mov, temp, blocked);
+            for (auto& [dst, src] : copies) {
+                if (src == blocked) {
+                    src = temp;
+                }
+            }
+        }
+    }
 
-    const NodeProg m_prog;
-    std::stringstream m_output;
-    size_t m_stack_size = 0;
-    std::vector<Var> m_vars{};
-    std::vector<size_t> m_scopes{};
-    int m_label_count = 0;
+    const IrProg m_prog;
+    Target m_target;
+    std::vector<std::optional<uint64_t>> m_consts;
+    std::vector<Instr> m_output{};
+    size_t m_vreg_count;
+    int m_label_count;
+    int m_return_label = -1;
+    size_t m_frame_bytes = 0;
 };
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ast.h"
+#include "error.h"
+#include "interner.h"
+#include "parser.h"
+#include "tokenizer.h"
+
+// Front end for a source that is edited in place, such as an editor buffer. It remembers the byte range
+// of every top-level statement, and after an edit it re-lexes and re-parses only from the statement
+// before the damage up to the first untouched statement whose start it lands on again; every other
+// statement keeps its subtree. The cost of an edit therefore depends on the statements it touches, not
+// on the size of the file.
+//
+// Re-parsed statements are appended to the same Ast, so replaced subtrees are left behind as garbage;
+// once that outweighs the live tree the whole file is parsed again from scratch to compact it.
+class IncrementalParser{
+public:
+    struct Edit{
+        size_t offset;
+        size_t removed;
+        std::string_view inserted;
+    };
+
+    struct Stats{
+        size_t reparsed; // top-level statements parsed by the last edit
+        size_t reused;   // top-level statements kept from before it
+    };
+
+    // Throws CompileError if the initial text doesn't parse; edits can still be applied to fix it
+    explicit IncrementalParser(std::string text)
+        : m_text(std::move(text))
+    {
+        parse_all();
+    }
+
+    // Applies an edit to the text and brings the AST up to date. A CompileError is thrown if the
+    // edited text doesn't parse, but the edit is kept, and the next edit re-parses the broken part.
+    void apply(const Edit& edit){
+        if (edit.offset > m_text.size() || edit.removed > m_text.size() - edit.offset) {
+            throw std::out_of_range("Edit outside of the source");
+        }
+        const auto lines_removed = std::count(m_text.begin() + edit.offset,
+                                              m_text.begin() + edit.offset + edit.removed, '\n');
+        const auto lines_inserted = std::count(edit.inserted.begin(), edit.inserted.end(), '\n');
+        m_text.replace(edit.offset, edit.removed, edit.inserted);
+
+        if (garbage_exceeds_live()) {
+            parse_all();
+            return;
+        }
+
+        // Statements ending at or after the edit are damaged; so is an if right before them, since a
+        // new elif or else would extend it. While part of the text doesn't parse, every edit parses
+        // that part again as well, wherever it lands: the edit may be the one that fixes it, and if
+        // not, the error reported is that of the current text, with its current line.
+        size_t first = partition_point(0, [&](const size_t i){ return at(i).end < edit.offset; });
+        const auto broken = [](const TopStmt& stmt){ return stmt.broken; };
+        if (m_broken > 0) {
+            first = std::min<size_t>(first, std::ranges::find_if(m_stmts, broken) - m_stmts.begin());
+        }
+        while (first > 0 && m_ast.kind(m_stmts[first - 1].stmt) == StmtKind::if_) {
+            first--;
+        }
+        // Statements starting after the removed text are unchanged, and parsing can rejoin them
+        size_t rejoin = partition_point(first, [&](const size_t i){ return at(i).begin < edit.offset + edit.removed; });
+        if (m_broken > 0) {
+            const auto last_broken = std::find_if(m_stmts.rbegin(), m_stmts.rend(), broken);
+            rejoin = std::max<size_t>(rejoin, m_stmts.rend() - last_broken);
+        }
+
+        shift_from(rejoin, {
+            .bytes = static_cast<int64_t>(edit.inserted.size()) - static_cast<int64_t>(edit.removed),
+            .lines = static_cast<int>(lines_inserted - lines_removed),
+        });
+        reparse(first, rejoin, edit.offset + edit.inserted.size());
+    }
+
+    [[nodiscard]] const std::string& text() const{
+        return m_text;
+    }
+
+    [[nodiscard]] const Interner& interner() const{
+        return m_interner;
+    }
+
+    [[nodiscard]] Stats last_stats() const{
+        return m_stats;
+    }
+
+    // A standalone copy of the program for the rest of the pipeline, which rewrites the AST as it goes.
+    // Throws the parse error of the current text if it doesn't parse.
+    [[nodiscard]] Ast snapshot() const{
+        if (m_broken > 0) {
+            compile_error(m_error);
+        }
+        Ast ast = m_ast;
+        ExprWalker walker;
+        std::vector<StmtId> root;
+        root.reserve(m_stmts.size());
+        for (size_t i = 0; i < m_stmts.size(); i++) {
+            const TopStmt stmt = at(i);
+            root.push_back(stmt.stmt);
+            if (stmt.line_shift != 0) {
+                shift_lines(ast, walker, stmt.stmt, stmt.line_shift);
+            }
+        }
+        ast.root = ast.add_body(root);
+        return ast;
+    }
+
+private:
+    // A top-level statement and the source range from its first token to the end of its last one. A
+    // broken entry stands for text that failed to parse, up to the end of the edit that broke it.
+    struct TopStmt{
+        uint32_t begin;
+        uint32_t end;
+        int end_line;
+        // Lines added above the statement since it was parsed; its identifiers still carry the old
+        // lines, which snapshot() corrects in its copy rather than every edit rewriting the subtree
+        int line_shift;
+        StmtId stmt;
+        bool broken;
+    };
+
+    struct Shift{
+        int64_t bytes;
+        int lines;
+    };
+
+    std::string m_text;
+    Interner m_interner{};
+    Ast m_ast{};
+    std::vector<TopStmt> m_stmts{};
+    // Everything from m_shift_from on has yet to be moved by m_shift. Consecutive edits mostly land
+    // near each other, so deferring the shift means only the entries between two edits are touched,
+    // instead of every entry after each one.
+    size_t m_shift_from = 0;
+    Shift m_shift{};
+    size_t m_broken = 0;
+    std::string m_error{};
+    Stats m_stats{};
+    // Node count right after the last full parse
+    size_t m_full_size = 0;
+
+    [[nodiscard]] TopStmt at(const size_t i) const{
+        TopStmt stmt = m_stmts[i];
+        if (i >= m_shift_from) {
+            move(stmt, m_shift);
+        }
+        return stmt;
+    }
+
+    static void move(TopStmt& stmt, const Shift& shift){
+        stmt.begin = static_cast<uint32_t>(stmt.begin + shift.bytes);
+        stmt.end = static_cast<uint32_t>(stmt.end + shift.bytes);
+        stmt.end_line += shift.lines;
+        stmt.line_shift += shift.lines;
+    }
+
+    // First index from `begin` on for which `before` is false
+    template <typename Pred>
+    [[nodiscard]] size_t partition_point(size_t begin, const Pred& before) const{
+        size_t count = m_stmts.size() - begin;
+        while (count > 0) {
+            const size_t half = count / 2;
+            if (before(begin + half)) {
+                begin += half + 1;
+                count -= half + 1;
+            }
+            else {
+                count = half;
+            }
+        }
+        return begin;
+    }
+
+    // Moves every entry from `from` on by `shift`, on top of the shift already pending
+    void shift_from(const size_t from, const Shift& shift){
+        if (shift.bytes == 0 && shift.lines == 0) {
+            return;
+        }
+        if (m_shift.bytes == 0 && m_shift.lines == 0) {
+            m_shift_from = from;
+        }
+        else if (m_shift_from < from) {
+            for (size_t i = m_shift_from; i < from; i++) {
+                move(m_stmts[i], m_shift);
+            }
+            m_shift_from = from;
+        }
+        else {
+            for (size_t i = from; i < m_shift_from; i++) {
+                move(m_stmts[i], shift);
+            }
+        }
+        m_shift.bytes += shift.bytes;
+        m_shift.lines += shift.lines;
+    }
+
+    [[nodiscard]] size_t node_count() const{
+        return m_ast.expr_kinds.size() + m_ast.stmt_kinds.size();
+    }
+
+    [[nodiscard]] bool garbage_exceeds_live() const{
+        return node_count() > 2 * m_full_size + 1024;
+    }
+
+    void parse_all(){
+        m_ast = Ast{};
+        m_interner.clear();
+        m_stmts.clear();
+        m_shift_from = 0;
+        m_shift = {};
+        m_broken = 0;
+        try {
+            reparse(0, 0, m_text.size());
+        }
+        catch (const CompileError&) {
+            m_full_size = node_count();
+            throw;
+        }
+        m_full_size = node_count();
+    }
+
+    // Replaces m_stmts[first, rejoin) by parsing from the end of the statement before `first`. Parsing
+    // stops as soon as it reaches the start of one of the statements from `rejoin` on, which are
+    // already shifted to the edited text; those before it are dropped. On a parse error, everything
+    // from `first` up to the first statement past `damage_end` is replaced by one broken entry.
+    void reparse(const size_t first, const size_t rejoin, const size_t damage_end){
+        const uint32_t resume = first == 0 ? 0 : at(first - 1).end;
+        const int resume_line = first == 0 ? 1 : at(first - 1).end_line;
+        Parser parser(Tokenizer(m_text, m_interner, resume, resume_line), std::move(m_ast));
+
+        std::vector<TopStmt> parsed;
+        size_t next = rejoin;
+        try {
+            while (const std::optional<Token> token = parser.next_token()) {
+                while (next < m_stmts.size() && (at(next).begin < token->begin || m_stmts[next].broken)) {
+                    next++;
+                }
+                if (next < m_stmts.size() && at(next).begin == token->begin) {
+                    break;
+                }
+                const std::optional<StmtId> stmt = parser.parse_stmt();
+                if (!stmt.has_value()) {
+                    compile_error("Invalid statement");
+                }
+                parsed.push_back({
+                    .begin = token->begin,
+                    .end = parser.consumed_end(),
+                    .end_line = parser.consumed_line(),
+                    .line_shift = 0,
+                    .stmt = stmt.value(),
+                    .broken = false,
+                });
+            }
+            if (!parser.next_token().has_value()) {
+                next = m_stmts.size();
+            }
+        }
+        catch (const CompileError& e) {
+            m_ast = parser.take_ast();
+            m_error = e.what();
+            next = rejoin;
+            while (next < m_stmts.size() && at(next).begin < damage_end) {
+                next++;
+            }
+            parsed.assign(1, {
+                .begin = resume,
+                .end = static_cast<uint32_t>(std::max(damage_end, static_cast<size_t>(resume))),
+                .end_line = resume_line,
+                .line_shift = 0,
+                .stmt = {},
+                .broken = true,
+            });
+            splice(first, next, parsed);
+            throw;
+        }
+        m_ast = parser.take_ast();
+        splice(first, next, parsed);
+    }
+
+    static void shift_lines(Ast& ast, ExprWalker& walker, const ExprId expr, const int shift){
+        for (const ExprId node : walker.postorder(ast, expr)) {
+            if (ast.kind(node) == ExprKind::ident) {
+                ast.idents[ast.ident_index(node)].line += shift;
+            }
+        }
+    }
+
+    static void shift_lines(Ast& ast, ExprWalker& walker, const StmtId stmt, const int shift){
+        switch (ast.kind(stmt)) {
+        case StmtKind::exit:
+            shift_lines(ast, walker, ast.exit_expr(stmt), shift);
+            break;
+        case StmtKind::let:
+        case StmtKind::assign:
+            ast.store(stmt).ident.line += shift;
+            shift_lines(ast, walker, ast.store(stmt).expr, shift);
+            break;
+        case StmtKind::scope:
+            for (const StmtId child : ast.stmts(ast.scope_body(stmt))) {
+                shift_lines(ast, walker, child, shift);
+            }
+            break;
+        case StmtKind::if_:
+            for (const Arm& arm : ast.if_arms(stmt)) {
+                if (arm.cond != no_expr) {
+                    shift_lines(ast, walker, arm.cond, shift);
+                }
+                for (const StmtId child : ast.stmts(arm.body)) {
+                    shift_lines(ast, walker, child, shift);
+                }
+            }
+            break;
+        case StmtKind::while_:
+            shift_lines(ast, walker, ast.while_stmt(stmt).cond, shift);
+            for (const StmtId child : ast.stmts(ast.while_stmt(stmt).body)) {
+                shift_lines(ast, walker, child, shift);
+            }
+            break;
+        }
+    }
+
+    // Parsed entries are exact, so after the splice the pending shift applies to what followed `last`
+    void splice(const size_t first, const size_t last, const std::vector<TopStmt>& parsed){
+        m_stats = {.reparsed = parsed.size(), .reused = first + (m_stmts.size() - last)};
+        for (size_t i = first; i < last; i++) {
+            m_broken -= m_stmts[i].broken;
+        }
+        for (const TopStmt& stmt : parsed) {
+            m_broken += stmt.broken;
+        }
+
+        for (size_t i = m_shift_from; i < first; i++) {
+            move(m_stmts[i], m_shift);
+        }
+        if (m_shift_from < last) {
+            m_shift_from = last;
+        }
+        if (parsed.size() == last - first) {
+            std::copy(parsed.begin(), parsed.end(), m_stmts.begin() + first);
+            return;
+        }
+        m_stmts.erase(m_stmts.begin() + first, m_stmts.begin() + last);
+        m_stmts.insert(m_stmts.begin() + first, parsed.begin(), parsed.end());
+        m_shift_from = m_shift_from + parsed.size() - (last - first);
+    }
+};
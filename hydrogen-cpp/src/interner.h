@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+
+using SymbolId = uint32_t;
+
+// Maps each distinct identifier to a dense SymbolId. The first occurrence of a name is copied into
+// the interner's arena, so symbols stay valid independently of the source text.
+class Interner{
+public:
+    Interner()
+        : m_allocator(16 * 1024),
+          m_table(initial_capacity, empty)
+    {}
+
+    SymbolId intern(const std::string_view name){
+        const uint64_t hash = hash_name(name);
+        size_t i = hash & (m_table.size() - 1);
+        while (m_table[i] != empty) {
+            const SymbolId symbol = m_table[i];
+            if (m_hashes[symbol] == hash && m_names[symbol] == name) {
+                return symbol;
+            }
+            i = (i + 1) & (m_table.size() - 1);
+        }
+
+        const auto symbol = static_cast<SymbolId>(m_names.size());
+        char* text = m_allocator.alloc_array<char>(name.size());
+        std::memcpy(text, name.data(), name.size());
+        m_names.emplace_back(text, name.size());
+        m_hashes.push_back(hash);
+        m_table[i] = symbol;
+        // Keep the table at most half full
+        if (m_names.size() * 2 > m_table.size()) {
+            grow();
+        }
+        return symbol;
+    }
+
+    // Forgets every symbol but keeps the table and arena storage for the next file
+    void clear(){
+        m_names.clear();
+        m_hashes.clear();
+        std::fill(m_table.begin(), m_table.end(), empty);
+        m_allocator.reset();
+    }
+
+    [[nodiscard]] std::string_view name(const SymbolId symbol) const{
+        return m_names[symbol];
+    }
+
+    [[nodiscard]] size_t size() const{
+        return m_names.size();
+    }
+
+    [[nodiscard]] ArenaAllocator::Stats arena_stats() const{
+        return m_allocator.stats();
+    }
+
+private:
+    static constexpr size_t initial_capacity = 256;
+    static constexpr SymbolId empty = UINT32_MAX;
+
+    ArenaAllocator m_allocator;
+    std::vector<std::string_view> m_names{};
+    std::vector<uint64_t> m_hashes{};
+    // Open addressing with linear probing; slots hold symbols, or `empty`
+    std::vector<SymbolId> m_table;
+
+    // FNV-1a
+    static uint64_t hash_name(const std::string_view name){
+        uint64_t hash = 0xCBF29CE484222325;
+        for (const char c : name) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3;
+        }
+        return hash;
+    }
+
+    void grow(){
+        m_table.assign(m_table.size() * 2, empty);
+        for (SymbolId symbol = 0; symbol < m_names.size(); symbol++) {
+            size_t i = m_hashes[symbol] & (m_table.size() - 1);
+            while (m_table[i] != empty) {
+                i = (i + 1) & (m_table.size() - 1);
+            }
+            m_table[i] = symbol;
+        }
+    }
+};
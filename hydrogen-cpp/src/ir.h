@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "out_buffer.h"
+
+// SSA form of a program: every value is defined exactly once, either by an instruction or by a
+// phi at the start of a block. Value ids double as virtual register numbers in the backend.
+using ValueId = uint32_t;
+using BlockId = uint32_t;
+
+enum class IrOp : uint8_t{
+    const_,
+    add,
+    sub,
+    mul,
+    div
+};
+
+inline std::string_view to_string(const IrOp op){
+    switch (op) {
+    case IrOp::const_:
+        return "const";
+    case IrOp::add:
+        return "add";
+    case IrOp::sub:
+        return "sub";
+    case IrOp::mul:
+        return "mul";
+    case IrOp::div:
+        return "div";
+    }
+
+    assert(false);
+    __builtin_unreachable();
+}
+
+struct IrInst{
+    IrOp op;
+    ValueId dst;
+    ValueId lhs = 0;
+    ValueId rhs = 0;
+    uint64_t imm = 0; // only used by IrOp::const_
+};
+
+// args[i] is the value flowing in from preds[i] of the owning block
+struct IrPhi{
+    ValueId dst;
+    std::vector<ValueId> args{};
+};
+
+struct IrTerm{
+    enum class Kind : uint8_t{
+        jmp,
+        br,
+        exit
+    };
+
+    Kind kind = Kind::exit;
+    ValueId value = 0; // branch condition or exit code
+    BlockId target = 0; // jmp target, or br target when value != 0
+    BlockId else_target = 0; // br target when value == 0
+};
+
+struct IrBlock{
+    std::vector<BlockId> preds{};
+    std::vector<IrPhi> phis{};
+    std::vector<IrInst> insts{};
+    IrTerm term{};
+
+    [[nodiscard]] std::vector<BlockId> succs() const{
+        switch (term.kind) {
+        case IrTerm::Kind::jmp:
+            return {term.target};
+        case IrTerm::Kind::br:
+            return {term.target, term.else_target};
+        case IrTerm::Kind::exit:
+            return {};
+        }
+
+        assert(false);
+        __builtin_unreachable();
+    }
+};
+
+// Block 0 is the entry block
+struct IrProg{
+    std::vector<IrBlock> blocks{};
+    ValueId value_count = 0;
+};
+
+inline void write_ir(OutBuffer& out, const IrProg& prog){
+    for (BlockId b = 0; b < prog.blocks.size(); b++) {
+        const IrBlock& ir_block = prog.blocks[b];
+        out << "bb" << b << ':';
+        for (const BlockId pred : ir_block.preds) {
+            out << " bb" << pred;
+        }
+        out << '\n';
+        for (const IrPhi& phi : ir_block.phis) {
+            out << "    %" << phi.dst << " = phi";
+            for (size_t i = 0; i < phi.args.size(); i++) {
+                out << (i == 0 ? " %" : ", %") << phi.args[i];
+            }
+            out << '\n';
+        }
+        for (const IrInst& inst : ir_block.insts) {
+            out << "    %" << inst.dst << " = " << to_string(inst.op) << ' ';
+            if (inst.op == IrOp::const_) {
+                out << inst.imm << '\n';
+            }
+            else {
+                out << '%' << inst.lhs << ", %" << inst.rhs << '\n';
+            }
+        }
+        switch (ir_block.term.kind) {
+        case IrTerm::Kind::jmp:
+            out << "    jmp bb" << ir_block.term.target << '\n';
+            break;
+        case IrTerm::Kind::br:
+            out << "    br %" << ir_block.term.value << ", bb" << ir_block.term.target << ", bb"
+                << ir_block.term.else_target << '\n';
+            break;
+        case IrTerm::Kind::exit:
+            out << "    exit %" << ir_block.term.value << '\n';
+            break;
+        }
+    }
+}
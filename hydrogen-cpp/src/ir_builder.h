@@ -0,0 +1,284 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "ast.h"
+#include "ir.h"
+
+// Lowers the AST into SSA form. Variables are tracked as the value they currently hold, and a phi is
+// placed at an if/elif/else join for every variable whose value differs between the incoming arms.
+// An if without else gets an empty fallthrough block so that no edge into a join is critical.
+// A while loop gets a header block holding a phi for every variable in scope and the condition; the
+// block before it is the loop's only entry and its preheader, and phis that turn out not to change
+// around the loop are left for IrOptimizer to remove.
+class IrBuilder{
+public:
+    explicit IrBuilder(const Ast& ast)
+        : m_ast(ast),
+          m_values(ast.slot_count)
+    {}
+
+    [[nodiscard]] IrProg build(){
+        m_current = create_block();
+        lower_stmts(m_ast.root);
+        if (m_current.has_value()) {
+            terminate({.kind = IrTerm::Kind::exit, .value = lower_const(0)});
+        }
+        return std::move(m_ir);
+    }
+
+private:
+    struct Incoming{
+        BlockId block;
+        std::vector<ValueId> values;
+    };
+
+    const Ast& m_ast;
+    IrProg m_ir{};
+    std::optional<BlockId> m_current{};
+    // Current value of each variable slot, and the slots in scope in declaration order
+    std::vector<ValueId> m_values;
+    std::vector<uint32_t> m_vars{};
+    std::vector<size_t> m_scopes{};
+    ExprWalker m_walker{};
+    // Values of the operands lower_expr has lowered but not yet used
+    std::vector<ValueId> m_operands{};
+
+    BlockId create_block(){
+        m_ir.blocks.emplace_back();
+        return static_cast<BlockId>(m_ir.blocks.size() - 1);
+    }
+
+    ValueId create_value(){
+        return m_ir.value_count++;
+    }
+
+    IrBlock& current(){
+        return m_ir.blocks[m_current.value()];
+    }
+
+    void terminate(const IrTerm& term){
+        current().term = term;
+        switch (term.kind) {
+        case IrTerm::Kind::br:
+            m_ir.blocks[term.else_target].preds.push_back(m_current.value());
+            [[fallthrough]];
+        case IrTerm::Kind::jmp:
+            m_ir.blocks[term.target].preds.push_back(m_current.value());
+            break;
+        case IrTerm::Kind::exit:
+            break;
+        }
+        m_current.reset();
+    }
+
+    ValueId lower_const(const uint64_t value){
+        const ValueId dst = create_value();
+        current().insts.push_back({.op = IrOp::const_, .dst = dst, .imm = value});
+        return dst;
+    }
+
+    ValueId lower_inst(const IrOp op, const ValueId lhs, const ValueId rhs){
+        const ValueId dst = create_value();
+        current().insts.push_back({.op = op, .dst = dst, .lhs = lhs, .rhs = rhs});
+        return dst;
+    }
+
+    ValueId lower_expr(const ExprId expr){
+        for (const ExprId node : m_walker.postorder(m_ast, expr)) {
+            m_operands.push_back(lower_node(node));
+        }
+        const ValueId value = m_operands.back();
+        m_operands.clear();
+        return value;
+    }
+
+    // Lowers one node whose operands' values are on top of m_operands, popping them
+    ValueId lower_node(const ExprId expr){
+        switch (m_ast.kind(expr)) {
+        case ExprKind::int_lit:
+            return lower_const(m_ast.int_lit(expr));
+        case ExprKind::ident:
+            return m_values[m_ast.slot(expr)];
+        case ExprKind::add:
+            return lower_bin(IrOp::add);
+        case ExprKind::sub:
+            return lower_bin(IrOp::sub);
+        case ExprKind::mul:
+            return lower_bin(IrOp::mul);
+        case ExprKind::div:
+            return lower_bin(IrOp::div);
+        }
+        assert(false);
+        return 0;
+    }
+
+    ValueId lower_bin(const IrOp op){
+        const ValueId rhs_value = m_operands.back();
+        m_operands.pop_back();
+        const ValueId lhs_value = m_operands.back();
+        m_operands.pop_back();
+        return lower_inst(op, lhs_value, rhs_value);
+    }
+
+    void lower_stmts(const BodyId body){
+        for (const StmtId stmt : m_ast.stmts(body)) {
+            if (!m_current.has_value()) {
+                // Everything after an exit is unreachable
+                return;
+            }
+            lower_stmt(stmt);
+        }
+    }
+
+    void lower_scope(const BodyId body){
+        m_scopes.push_back(m_vars.size());
+        lower_stmts(body);
+        m_vars.resize(m_scopes.back());
+        m_scopes.pop_back();
+    }
+
+    [[nodiscard]] std::vector<ValueId> snapshot() const{
+        std::vector<ValueId> values;
+        values.reserve(m_vars.size());
+        for (const uint32_t slot : m_vars) {
+            values.push_back(m_values[slot]);
+        }
+        return values;
+    }
+
+    void restore(const std::vector<ValueId>& values){
+        for (size_t i = 0; i < values.size(); i++) {
+            m_values[m_vars[i]] = values[i];
+        }
+    }
+
+    // Lowers an arm starting in a fresh block and records where it falls through, if anywhere
+    void lower_arm(const BlockId block, const BodyId body, const std::vector<ValueId>& before,
+                   std::vector<Incoming>& incoming){
+        m_current = block;
+        restore(before);
+        lower_scope(body);
+        if (m_current.has_value()) {
+            incoming.push_back({.block = m_current.value(), .values = snapshot()});
+            m_current.reset();
+        }
+    }
+
+    void lower_if(const StmtId stmt){
+        const std::vector<ValueId> before = snapshot();
+        std::vector<Incoming> incoming;
+
+        const std::span<const Arm> arms = m_ast.if_arms(stmt);
+        for (size_t i = 0; i < arms.size(); i++) {
+            if (arms[i].cond == no_expr) {
+                lower_arm(m_current.value(), arms[i].body, before, incoming);
+                break;
+            }
+            const ValueId cond_value = lower_expr(arms[i].cond);
+            const BlockId then_block = create_block();
+            const BlockId else_block = create_block();
+            terminate({.kind = IrTerm::Kind::br, .value = cond_value, .target = then_block, .else_target = else_block});
+            lower_arm(then_block, arms[i].body, before, incoming);
+            m_current = else_block;
+            restore(before);
+
+            if (i + 1 == arms.size()) {
+                incoming.push_back({.block = else_block, .values = before});
+            }
+        }
+        m_current.reset();
+
+        if (incoming.empty()) {
+            return;
+        }
+        const BlockId join = create_block();
+        for (const Incoming& in : incoming) {
+            m_current = in.block;
+            terminate({.kind = IrTerm::Kind::jmp, .target = join});
+        }
+        m_current = join;
+
+        for (size_t i = 0; i < before.size(); i++) {
+            const ValueId first = incoming.front().values[i];
+            const bool same = std::ranges::all_of(incoming, [&](const Incoming& in){
+                return in.values[i] == first;
+            });
+            if (same) {
+                m_values[m_vars[i]] = first;
+                continue;
+            }
+            IrPhi phi{.dst = create_value()};
+            for (const Incoming& in : incoming) {
+                phi.args.push_back(in.values[i]);
+            }
+            m_values[m_vars[i]] = phi.dst;
+            current().phis.push_back(std::move(phi));
+        }
+    }
+
+    void lower_while(const StmtId stmt){
+        const WhileStmt& loop = m_ast.while_stmt(stmt);
+        const BlockId header = create_block();
+        const std::vector<ValueId> before = snapshot();
+        terminate({.kind = IrTerm::Kind::jmp, .target = header});
+
+        m_current = header;
+        for (size_t i = 0; i < before.size(); i++) {
+            const ValueId dst = create_value();
+            current().phis.push_back({.dst = dst, .args = {before[i]}});
+            m_values[m_vars[i]] = dst;
+        }
+        const std::vector<ValueId> head = snapshot();
+        const ValueId cond_value = lower_expr(loop.cond);
+
+        // The exit block is created after the body's blocks, so the loop is laid out contiguously
+        const BlockId body_block = create_block();
+        m_current = body_block;
+        lower_scope(loop.body);
+        if (m_current.has_value()) {
+            const std::vector<ValueId> latch = snapshot();
+            terminate({.kind = IrTerm::Kind::jmp, .target = header});
+            for (size_t i = 0; i < latch.size(); i++) {
+                m_ir.blocks[header].phis[i].args.push_back(latch[i]);
+            }
+        }
+        const BlockId exit_block = create_block();
+        m_current = header;
+        terminate({.kind = IrTerm::Kind::br, .value = cond_value, .target = body_block, .else_target = exit_block});
+        m_current = exit_block;
+        restore(head);
+    }
+
+    void lower_stmt(const StmtId stmt){
+        switch (m_ast.kind(stmt)) {
+        case StmtKind::exit: {
+            const ValueId value = lower_expr(m_ast.exit_expr(stmt));
+            terminate({.kind = IrTerm::Kind::exit, .value = value});
+            break;
+        }
+        case StmtKind::let: {
+            const ValueId value = lower_expr(m_ast.store(stmt).expr);
+            m_values[m_ast.store_slot(stmt)] = value;
+            m_vars.push_back(m_ast.store_slot(stmt));
+            break;
+        }
+        case StmtKind::assign:
+            m_values[m_ast.store_slot(stmt)] = lower_expr(m_ast.store(stmt).expr);
+            break;
+        case StmtKind::scope:
+            lower_scope(m_ast.scope_body(stmt));
+            break;
+        case StmtKind::if_:
+            lower_if(stmt);
+            break;
+        case StmtKind::while_:
+            lower_while(stmt);
+            break;
+        }
+    }
+};
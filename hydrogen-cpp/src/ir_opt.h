@@ -0,0 +1,424 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "ir.h"
+
+// Optimizations over the SSA IR: global value numbering over the dominator tree (which also folds
+// constants and removes trivial phis), loop-invariant code motion, then dead code elimination.
+class IrOptimizer{
+public:
+    explicit IrOptimizer(IrProg& prog)
+        : m_prog(prog),
+          m_replace(prog.value_count),
+          m_consts(prog.value_count)
+    {
+        for (ValueId v = 0; v < prog.value_count; v++) {
+            m_replace[v] = v;
+        }
+    }
+
+    void run(){
+        compute_dominators();
+        number_values();
+        hoist_invariants();
+        eliminate_dead_code();
+    }
+
+private:
+    struct Key{
+        IrOp op;
+        ValueId lhs;
+        ValueId rhs;
+        uint64_t imm;
+
+        [[nodiscard]] bool operator==(const Key&) const = default;
+    };
+
+    struct KeyHash{
+        size_t operator()(const Key& key) const{
+            uint64_t h = static_cast<uint64_t>(key.op);
+            h = h * 0x9E3779B97F4A7C15 + key.lhs;
+            h = h * 0x9E3779B97F4A7C15 + key.rhs;
+            h = h * 0x9E3779B97F4A7C15 + key.imm;
+            return h ^ (h >> 29);
+        }
+    };
+
+    IrProg& m_prog;
+    std::vector<ValueId> m_replace;
+    std::vector<std::optional<uint64_t>> m_consts;
+    std::vector<BlockId> m_rpo{};
+    std::vector<BlockId> m_idom{};
+    std::vector<std::vector<BlockId>> m_dom_children{};
+
+    static constexpr BlockId no_block = UINT32_MAX;
+
+    ValueId resolve(ValueId value){
+        while (m_replace[value] != value) {
+            value = m_replace[value] = m_replace[m_replace[value]];
+        }
+        return value;
+    }
+
+    // Cooper, Harvey and Kennedy's iterative algorithm over reverse postorder
+    void compute_dominators(){
+        const size_t count = m_prog.blocks.size();
+        std::vector<BlockId>& rpo = m_rpo;
+        std::vector<uint32_t> rpo_index(count, UINT32_MAX);
+        {
+            std::vector<bool> visited(count);
+            std::vector<std::pair<BlockId, size_t>> stack{{0, 0}};
+            visited[0] = true;
+            while (!stack.empty()) {
+                auto& [block, next] = stack.back();
+                const std::vector<BlockId> succs = m_prog.blocks[block].succs();
+                if (next < succs.size()) {
+                    const BlockId succ = succs[next++];
+                    if (!visited[succ]) {
+                        visited[succ] = true;
+                        stack.emplace_back(succ, 0);
+                    }
+                    continue;
+                }
+                rpo.push_back(block);
+                stack.pop_back();
+            }
+            std::ranges::reverse(rpo);
+            for (uint32_t i = 0; i < rpo.size(); i++) {
+                rpo_index[rpo[i]] = i;
+            }
+        }
+
+        m_idom.assign(count, no_block);
+        m_idom[0] = 0;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (const BlockId block : rpo) {
+                if (block == 0) continue;
+                BlockId idom = no_block;
+                for (const BlockId pred : m_prog.blocks[block].preds) {
+                    if (m_idom[pred] == no_block) continue;
+                    if (idom == no_block) {
+                        idom = pred;
+                        continue;
+                    }
+                    BlockId a = pred;
+                    BlockId b = idom;
+                    while (a != b) {
+                        while (rpo_index[a] > rpo_index[b]) a = m_idom[a];
+                        while (rpo_index[b] > rpo_index[a]) b = m_idom[b];
+                    }
+                    idom = a;
+                }
+                if (idom != m_idom[block]) {
+                    m_idom[block] = idom;
+                    changed = true;
+                }
+            }
+        }
+
+        m_dom_children.assign(count, {});
+        for (const BlockId block : rpo) {
+            if (block != 0) {
+                m_dom_children[m_idom[block]].push_back(block);
+            }
+        }
+    }
+
+    std::optional<uint64_t> fold(const IrOp op, const uint64_t lhs, const uint64_t rhs){
+        switch (op) {
+        case IrOp::add:
+            return lhs + rhs;
+        case IrOp::sub:
+            return lhs - rhs;
+        case IrOp::mul:
+            return lhs * rhs;
+        case IrOp::div:
+            if (rhs == 0) return {};
+            return lhs / rhs;
+        default:
+            return {};
+        }
+    }
+
+    // Returns the value an instruction reduces to through x + 0, x - 0, x * 1 and x / 1
+    std::optional<ValueId> simplify(const IrInst& inst){
+        const std::optional<uint64_t> rhs = m_consts[inst.rhs];
+        const std::optional<uint64_t> lhs = m_consts[inst.lhs];
+        switch (inst.op) {
+        case IrOp::add:
+            if (rhs == 0u) return inst.lhs;
+            if (lhs == 0u) return inst.rhs;
+            return {};
+        case IrOp::sub:
+            if (rhs == 0u) return inst.lhs;
+            return {};
+        case IrOp::mul:
+            if (rhs == 1u) return inst.lhs;
+            if (lhs == 1u) return inst.rhs;
+            return {};
+        case IrOp::div:
+            if (rhs == 1u) return inst.lhs;
+            return {};
+        default:
+            return {};
+        }
+    }
+
+    // A phi whose arguments are all one value, or itself, is replaced by that value
+    bool replace_trivial(IrPhi& phi){
+        std::optional<ValueId> same;
+        for (ValueId& arg : phi.args) {
+            arg = resolve(arg);
+            if (arg == phi.dst || arg == same) continue;
+            if (same.has_value()) return false;
+            same = arg;
+        }
+        if (!same.has_value()) return false;
+        m_replace[phi.dst] = same.value();
+        return true;
+    }
+
+    void number_block(const BlockId block_id, std::unordered_map<Key, ValueId, KeyHash>& table,
+                      std::vector<Key>& scoped){
+        IrBlock& block = m_prog.blocks[block_id];
+
+        std::erase_if(block.phis, [&](IrPhi& phi){
+            return replace_trivial(phi);
+        });
+
+        std::erase_if(block.insts, [&](IrInst& inst){
+            if (inst.op != IrOp::const_) {
+                inst.lhs = resolve(inst.lhs);
+                inst.rhs = resolve(inst.rhs);
+                const std::optional<uint64_t> lhs = m_consts[inst.lhs];
+                const std::optional<uint64_t> rhs = m_consts[inst.rhs];
+                if (lhs.has_value() && rhs.has_value()) {
+                    if (const std::optional<uint64_t> value = fold(inst.op, lhs.value(), rhs.value())) {
+                        inst = {.op = IrOp::const_, .dst = inst.dst, .imm = value.value()};
+                    }
+                }
+            }
+            if (inst.op != IrOp::const_) {
+                if (const std::optional<ValueId> same = simplify(inst)) {
+                    m_replace[inst.dst] = same.value();
+                    return true;
+                }
+                if ((inst.op == IrOp::add || inst.op == IrOp::mul) && inst.lhs > inst.rhs) {
+                    std::swap(inst.lhs, inst.rhs);
+                }
+            }
+            else {
+                m_consts[inst.dst] = inst.imm;
+            }
+
+            const Key key{.op = inst.op, .lhs = inst.lhs, .rhs = inst.rhs, .imm = inst.imm};
+            const auto [it, inserted] = table.try_emplace(key, inst.dst);
+            if (!inserted) {
+                m_replace[inst.dst] = it->second;
+                return true;
+            }
+            scoped.push_back(key);
+            return false;
+        });
+    }
+
+    void number_values(){
+        std::unordered_map<Key, ValueId, KeyHash> table;
+        std::vector<Key> scoped;
+
+        // Iterative preorder walk of the dominator tree; each entry remembers how many keys were in
+        // scope before its block so they can be dropped once the whole subtree is done
+        struct Frame{
+            BlockId block;
+            size_t child;
+            size_t scope_start;
+        };
+        std::vector<Frame> stack;
+        number_block(0, table, scoped);
+        stack.push_back({.block = 0, .child = 0, .scope_start = 0});
+        while (!stack.empty()) {
+            Frame& frame = stack.back();
+            if (frame.child < m_dom_children[frame.block].size()) {
+                const BlockId child = m_dom_children[frame.block][frame.child++];
+                const size_t scope_start = scoped.size();
+                number_block(child, table, scoped);
+                stack.push_back({.block = child, .child = 0, .scope_start = scope_start});
+                continue;
+            }
+            while (scoped.size() > frame.scope_start) {
+                table.erase(scoped.back());
+                scoped.pop_back();
+            }
+            stack.pop_back();
+        }
+
+        // A loop header's phis are numbered before the back edge's arguments are, so one that is only
+        // trivial once they have been replaced is caught here, along with any phi that depended on it
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (IrBlock& block : m_prog.blocks) {
+                changed |= std::erase_if(block.phis, [&](IrPhi& phi){
+                    return replace_trivial(phi);
+                }) > 0;
+            }
+        }
+
+        for (IrBlock& block : m_prog.blocks) {
+            for (IrPhi& phi : block.phis) {
+                for (ValueId& arg : phi.args) {
+                    arg = resolve(arg);
+                }
+            }
+            for (IrInst& inst : block.insts) {
+                if (inst.op != IrOp::const_) {
+                    inst.lhs = resolve(inst.lhs);
+                    inst.rhs = resolve(inst.rhs);
+                }
+            }
+            if (block.term.kind != IrTerm::Kind::jmp) {
+                block.term.value = resolve(block.term.value);
+            }
+        }
+    }
+
+    [[nodiscard]] bool dominates(const BlockId a, BlockId b) const{
+        while (b != a && b != 0) {
+            b = m_idom[b];
+        }
+        return b == a;
+    }
+
+    // Division stays where it is unless it cannot fault, since the loop might not run at all
+    [[nodiscard]] bool hoistable(const IrInst& inst) const{
+        return inst.op != IrOp::div || m_consts[inst.rhs].value_or(0) != 0;
+    }
+
+    // Moves instructions whose operands are all defined outside a loop into the loop's preheader, the
+    // single block that enters it. Inner loops go first, so an instruction can leave a whole nest.
+    void hoist_invariants(){
+        struct Loop{
+            BlockId header;
+            std::vector<bool> blocks;
+            size_t size = 0;
+        };
+
+        // Natural loops: a back edge is an edge to a block that dominates its source, and the loop is
+        // everything that reaches the source without passing through the header
+        std::vector<Loop> loops;
+        for (const BlockId block : m_rpo) {
+            for (const BlockId succ : m_prog.blocks[block].succs()) {
+                if (!dominates(succ, block)) continue;
+                Loop loop{.header = succ, .blocks = std::vector<bool>(m_prog.blocks.size())};
+                loop.blocks[succ] = true;
+                std::vector<BlockId> worklist{block};
+                while (!worklist.empty()) {
+                    const BlockId b = worklist.back();
+                    worklist.pop_back();
+                    if (loop.blocks[b]) continue;
+                    loop.blocks[b] = true;
+                    worklist.insert(worklist.end(), m_prog.blocks[b].preds.begin(), m_prog.blocks[b].preds.end());
+                }
+                loop.size = static_cast<size_t>(std::ranges::count(loop.blocks, true));
+                loops.push_back(std::move(loop));
+            }
+        }
+        std::ranges::stable_sort(loops, {}, &Loop::size);
+
+        std::vector<BlockId> def_block(m_prog.value_count);
+        for (BlockId b = 0; b < m_prog.blocks.size(); b++) {
+            for (const IrPhi& phi : m_prog.blocks[b].phis) {
+                def_block[phi.dst] = b;
+            }
+            for (const IrInst& inst : m_prog.blocks[b].insts) {
+                def_block[inst.dst] = b;
+            }
+        }
+
+        for (const Loop& loop : loops) {
+            const std::vector<BlockId>& preds = m_prog.blocks[loop.header].preds;
+            const auto outside = [&](const BlockId b){ return !loop.blocks[b]; };
+            if (std::ranges::count_if(preds, outside) != 1) continue;
+            const BlockId preheader = *std::ranges::find_if(preds, outside);
+            if (m_prog.blocks[preheader].term.kind != IrTerm::Kind::jmp) continue;
+
+            // Reverse postorder puts every definition before its uses
+            for (const BlockId b : m_rpo) {
+                if (!loop.blocks[b]) continue;
+                std::erase_if(m_prog.blocks[b].insts, [&](const IrInst& inst){
+                    const bool invariant = inst.op == IrOp::const_
+                        || (!loop.blocks[def_block[inst.lhs]] && !loop.blocks[def_block[inst.rhs]]);
+                    if (!invariant || !hoistable(inst)) {
+                        return false;
+                    }
+                    m_prog.blocks[preheader].insts.push_back(inst);
+                    def_block[inst.dst] = preheader;
+                    return true;
+                });
+            }
+        }
+    }
+
+    void eliminate_dead_code(){
+        struct Def{
+            const IrInst* inst = nullptr;
+            const IrPhi* phi = nullptr;
+        };
+
+        std::vector<Def> defs(m_prog.value_count);
+        std::vector<bool> live(m_prog.value_count);
+        std::vector<ValueId> worklist;
+        const auto mark = [&](const ValueId value){
+            if (!live[value]) {
+                live[value] = true;
+                worklist.push_back(value);
+            }
+        };
+
+        for (const IrBlock& block : m_prog.blocks) {
+            for (const IrPhi& phi : block.phis) {
+                defs[phi.dst].phi = &phi;
+            }
+            for (const IrInst& inst : block.insts) {
+                defs[inst.dst].inst = &inst;
+                // Division may fault, so it stays unless the divisor is a known non-zero constant
+                if (inst.op == IrOp::div && m_consts[inst.rhs].value_or(0) == 0) {
+                    mark(inst.dst);
+                }
+            }
+            if (block.term.kind != IrTerm::Kind::jmp) {
+                mark(block.term.value);
+            }
+        }
+
+        while (!worklist.empty()) {
+            const Def def = defs[worklist.back()];
+            worklist.pop_back();
+            if (def.phi != nullptr) {
+                for (const ValueId arg : def.phi->args) {
+                    mark(arg);
+                }
+            }
+            else if (def.inst != nullptr && def.inst->op != IrOp::const_) {
+                mark(def.inst->lhs);
+                mark(def.inst->rhs);
+            }
+        }
+
+        for (IrBlock& block : m_prog.blocks) {
+            std::erase_if(block.phis, [&](const IrPhi& phi){
+                return !live[phi.dst];
+            });
+            std::erase_if(block.insts, [&](const IrInst& inst){
+                return !live[inst.dst];
+            });
+        }
+    }
+};
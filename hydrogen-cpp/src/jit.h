@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <csetjmp>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "asm.h"
+
+// Runs a program compiled for Target::jit inside this process. The code is framed by a prologue that
+// saves the callee-saved registers it clobbers and an epilogue at its return label that restores them,
+// then copied into an anonymous mapping that is made executable and called like a function. A program
+// that faults (dividing by zero) is stopped and reported instead of taking hydro, or the daemon running
+// it, down with it.
+class JitProgram{
+public:
+    struct Result{
+        int exit_code; // what the program passed to exit(), truncated to 8 bits as the kernel would
+        int signal;    // the signal that stopped it, or 0 if it exited
+    };
+
+    // Callee-saved registers the program may write; rbp keeps the caller's stack pointer
+    static constexpr Reg saved[] = {Reg::rbx, Reg::rbp, Reg::r12, Reg::r13, Reg::r14, Reg::r15};
+
+    static void add_frame(std::vector<Instr>& instrs){
+        std::vector<Instr> framed;
+        framed.reserve(instrs.size() + 2 * std::size(saved) + 3);
+        for (const Reg reg : saved) {
+            framed.push_back({.op = Op::push, .dst = op_reg(reg)});
+        }
+        framed.push_back({.op = Op::mov, .dst = op_reg(Reg::rbp), .src = op_reg(Reg::rsp)});
+        framed.insert(framed.end(), instrs.begin(), instrs.end());
+        framed.push_back({.op = Op::mov, .dst = op_reg(Reg::rsp), .src = op_reg(Reg::rbp)});
+        for (size_t i = std::size(saved); i-- > 0;) {
+            framed.push_back({.op = Op::pop, .dst = op_reg(saved[i])});
+        }
+        framed.push_back({.op = Op::ret});
+        instrs = std::move(framed);
+    }
+
+    explicit JitProgram(const std::vector<uint8_t>& code)
+        : m_size(round_up(std::max<size_t>(code.size(), 1)))
+    {
+        void* mapping = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        }
+        m_code = mapping;
+        std::memcpy(m_code, code.data(), code.size());
+        if (::mprotect(m_code, m_size, PROT_READ | PROT_EXEC) != 0) {
+            const int error = errno;
+            ::munmap(m_code, m_size);
+            throw std::system_error(error, std::generic_category(), "mprotect");
+        }
+    }
+
+    JitProgram(const JitProgram&) = delete;
+
+    JitProgram& operator=(const JitProgram&) = delete;
+
+    ~JitProgram(){
+        ::munmap(m_code, m_size);
+    }
+
+    [[nodiscard]] Result run() const{
+        install_handlers();
+        sigjmp_buf escape;
+        if (const int signal = sigsetjmp(escape, 1); signal != 0) {
+            t_escape = nullptr;
+            return {.exit_code = 0, .signal = signal};
+        }
+        t_escape = &escape;
+        const uint64_t value = reinterpret_cast<uint64_t (*)()>(m_code)();
+        t_escape = nullptr;
+        return {.exit_code = static_cast<int>(value & 0xFF), .signal = 0};
+    }
+
+private:
+    static constexpr int guarded[] = {SIGFPE, SIGSEGV, SIGBUS, SIGILL};
+
+    // Set while this thread is inside program code
+    static inline thread_local sigjmp_buf* t_escape = nullptr;
+
+    void* m_code = nullptr;
+    size_t m_size;
+
+    static size_t round_up(const size_t bytes){
+        const auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        return (bytes + page - 1) / page * page;
+    }
+
+    // A fault outside program code is hydro's own, so it gets the default action when the faulting
+    // instruction runs again
+    static void on_fault(const int signal){
+        if (t_escape != nullptr) {
+            siglongjmp(*t_escape, signal);
+        }
+        std::signal(signal, SIG_DFL);
+    }
+
+    static void install_handlers(){
+        static std::once_flag once;
+        std::call_once(once, []{
+            struct sigaction action{};
+            action.sa_handler = on_fault;
+            sigemptyset(&action.sa_mask);
+            for (const int signal : guarded) {
+                sigaction(signal, &action, nullptr);
+            }
+        });
+    }
+};
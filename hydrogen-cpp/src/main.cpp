@@ -1,49 +1,20 @@
 #include <iostream>
-#include <fstream>
-#include <optional>
-#include <sstream>
+#include <string>
+#include <string_view>
 #include <vector>
 
-#include "./generator.h"
-#include "./parser.h"
-#include "./tokenizer.h"
+#include "./cli.h"
+#include "./protocol.h"
+#include "./server.h"
 
 int main(int argc, char* argv[]){
-    if (argc != 2) {
-        std::cerr << "Incorrect Usage: " << std::endl;
-        std::cerr << "Usage: hydro <input.hy>" << std::endl;
-        return EXIT_FAILURE;
-    }
-
-    std::string contents;
-
-    {
-        std::stringstream contents_stream;
-        std::fstream input(argv[1], std::ios::in);
-        contents_stream << input.rdbuf();
-        contents = contents_stream.str();
-    }
-
-    {
-        Tokenizer tokenizer(std::move(contents));
-        std::vector<Token> tokens = tokenizer.tokenize();
-
-        Parser parser(std::move(tokens));
-        std::optional<NodeProg> prog = parser.parse_prog();
-
-        if (!prog.has_value()) {
-            std::cerr << "Invalid program" << std::endl;
-            exit(EXIT_FAILURE);
+    if (argc >= 2 && std::string_view(argv[1]) == "--serve") {
+        if (argc > 3) {
+            cli::usage(std::cerr);
+            return EXIT_FAILURE;
         }
-
-        Generator generator(prog.value());
-
-        std::fstream file("out.asm", std::ios::out);
-        file << generator.gen_prog();
+        return CompileServer(argc == 3 ? argv[2] : protocol::default_socket_path()).run();
     }
 
-    system("nasm -felf64 out.asm");
-    system("ld -o out out.o");
-
-    return EXIT_SUCCESS;
+    return cli::run(std::vector<std::string>(argv + 1, argv + argc), "", std::cerr);
 }
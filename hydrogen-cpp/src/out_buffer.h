@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cerrno>
+#include <charconv>
+#include <concepts>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "error.h"
+
+// Buffered writer straight onto a file descriptor. Text is appended into a fixed 64K buffer that is
+// flushed whenever it fills up, and integers are formatted with to_chars, so there is no locale and
+// at most one buffer's worth of output in memory. Writes larger than the buffer bypass it.
+class OutBuffer{
+public:
+    explicit OutBuffer(const std::string& path, const mode_t mode = 0644)
+        : m_path(path),
+          m_fd(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode))
+    {
+        if (m_fd < 0) {
+            error("Could not open");
+        }
+    }
+
+    OutBuffer(const OutBuffer&) = delete;
+
+    OutBuffer& operator=(const OutBuffer&) = delete;
+
+    // Output still buffered is flushed on destruction, where errors can't be reported; call flush()
+    // first to find out whether everything was written
+    ~OutBuffer(){
+        try {
+            flush();
+        }
+        catch (const CompileError&) {
+        }
+        ::close(m_fd);
+    }
+
+    void write(const void* data, const size_t size){
+        if (size > capacity - m_size) {
+            flush();
+            if (size >= capacity) {
+                write_fd(static_cast<const char*>(data), size);
+                return;
+            }
+        }
+        std::memcpy(m_buffer + m_size, data, size);
+        m_size += size;
+    }
+
+    OutBuffer& operator<<(const std::string_view text){
+        write(text.data(), text.size());
+        return *this;
+    }
+
+    OutBuffer& operator<<(const char* text){
+        return *this << std::string_view(text);
+    }
+
+    OutBuffer& operator<<(const char c){
+        if (m_size == capacity) {
+            flush();
+        }
+        m_buffer[m_size++] = c;
+        return *this;
+    }
+
+    template <std::integral T>
+    OutBuffer& operator<<(const T value){
+        // Room for 20 digits and a sign
+        if (capacity - m_size < 21) {
+            flush();
+        }
+        m_size = std::to_chars(m_buffer + m_size, m_buffer + capacity, value).ptr - m_buffer;
+        return *this;
+    }
+
+    void flush(){
+        write_fd(m_buffer, m_size);
+        m_size = 0;
+    }
+
+private:
+    static constexpr size_t capacity = 64 * 1024;
+
+    [[noreturn]] void error(const char* msg) const{
+        compile_error("[Output Error] " + std::string(msg) + " " + m_path + ": " + std::strerror(errno));
+    }
+
+    void write_fd(const char* data, size_t size) const{
+        while (size > 0) {
+            const ssize_t n = ::write(m_fd, data, size);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                error("Failed to write");
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+    }
+
+    std::string m_path;
+    int m_fd;
+    size_t m_size = 0;
+    char m_buffer[capacity];
+};
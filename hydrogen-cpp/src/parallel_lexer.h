@@ -0,0 +1,220 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "interner.h"
+#include "thread_pool.h"
+#include "tokenizer.h"
+
+// Lexes a large source on several threads. The text is cut into chunks just after newlines, where no
+// token can continue, so only a block comment can span a cut. A first parallel pass scans each chunk
+// for comment delimiters twice, once as if it started outside a block comment and once as if inside,
+// and chaining those results from the start of the file tells every chunk how it really starts. The
+// chunks are then lexed in parallel, each into its own interner, and their symbols renumbered in order
+// of first appearance, so read one after the other the streams hold exactly the tokens Tokenizer
+// produces on one thread. A lex error ends the stream of its chunk and is thrown from there by the
+// parser, so a parse error earlier in the file is still the one reported.
+class ParallelLexer{
+public:
+    // Below this much text per chunk, starting threads costs more than it saves
+    static constexpr size_t min_chunk_bytes = 256 * 1024;
+
+    // Chunks run on `pool` when one is given, such as a long-running process's own, otherwise on a pool
+    // made for this text
+    ParallelLexer(const std::string_view src, Interner& interner, const size_t threads, ThreadPool* pool = nullptr)
+        : m_src(src),
+          m_interner(interner),
+          m_chunk_count(std::clamp<size_t>(src.size() / min_chunk_bytes, 1, std::max<size_t>(threads, 1))),
+          m_pool(pool)
+    {}
+
+    // The tokens come back as one stream per chunk, in source order, which saves copying them into
+    // one. The first chunk that fails to lex ends with its error, and no streams follow it.
+    [[nodiscard]] std::vector<TokenStream> lex(){
+        std::vector<TokenStream> streams;
+        if (m_chunk_count == 1) {
+            streams.emplace_back();
+            try {
+                Tokenizer(m_src, m_interner).tokenize(streams.back().tokens);
+            }
+            catch (const CompileError&) {
+                streams.back().error = std::current_exception();
+            }
+            return streams;
+        }
+
+        std::vector<Chunk> chunks(m_chunk_count);
+        split(chunks);
+        std::optional<ThreadPool> own_pool;
+        if (m_pool == nullptr) {
+            own_pool.emplace(chunks.size());
+        }
+        ThreadPool& pool = m_pool != nullptr ? *m_pool : own_pool.value();
+
+        pool.run_batch(chunks.size(), [this, &chunks](const size_t i){ scan_chunk(chunks[i]); });
+        bool open = false;
+        int line = 1;
+        for (Chunk& chunk : chunks) {
+            chunk.starts_open = open;
+            chunk.line = line;
+            open = chunk.ends_open[open];
+            line += chunk.newlines;
+        }
+
+        pool.run_batch(chunks.size(), [this, &chunks](const size_t i){ lex_chunk(chunks[i]); });
+
+        // Nothing after a chunk that failed to lex can be reached
+        const auto failed = std::ranges::find_if(chunks, [](const Chunk& chunk){ return chunk.error != nullptr; });
+        const std::span<Chunk> reached(chunks.begin(), failed == chunks.end() ? failed : failed + 1);
+
+        // Interning chunk by chunk, each in its own first-appearance order, numbers symbols the way a
+        // single pass over the whole text would
+        for (Chunk& chunk : reached) {
+            chunk.symbols.resize(chunk.interner.size());
+            for (SymbolId symbol = 0; symbol < chunk.interner.size(); symbol++) {
+                chunk.symbols[symbol] = m_interner.intern(chunk.interner.name(symbol));
+            }
+        }
+        pool.run_batch(reached.size(), [this, &reached](const size_t i){ rename_symbols(reached[i]); });
+
+        streams.reserve(reached.size());
+        for (Chunk& chunk : reached) {
+            streams.push_back({.tokens = std::move(chunk.tokens), .error = chunk.error});
+        }
+        return streams;
+    }
+
+private:
+    struct Chunk{
+        size_t begin = 0;
+        size_t end = 0;
+        // Whether a block comment is still open at the end of the chunk, indexed by whether one was
+        // open at its start
+        bool ends_open[2] = {false, false};
+        int newlines = 0;
+        bool starts_open = false;
+        int line = 1;
+        Interner interner{};
+        std::vector<Token> tokens{};
+        std::exception_ptr error{};
+        // Global symbol of each of the chunk's own symbols
+        std::vector<SymbolId> symbols{};
+    };
+
+    std::string_view m_src;
+    Interner& m_interner;
+    size_t m_chunk_count;
+    ThreadPool* m_pool;
+
+    // Equal chunks, each end moved forward to just past the next newline
+    void split(std::vector<Chunk>& chunks) const{
+        size_t begin = 0;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            size_t end = m_src.size();
+            if (i + 1 < chunks.size()) {
+                end = std::max(begin, m_src.size() / chunks.size() * (i + 1));
+                end = std::min(m_src.find('\n', end), m_src.size() - 1) + 1;
+            }
+            chunks[i].begin = begin;
+            chunks[i].end = end;
+            begin = end;
+        }
+    }
+
+    static const char* find(const char* p, const char* end, const char byte){
+        const void* found = std::memchr(p, byte, static_cast<size_t>(end - p));
+        return found != nullptr ? static_cast<const char*>(found) : end;
+    }
+
+    // Just past the `*/` closing a block comment whose text starts at `p`, or nullptr if it doesn't
+    // close before `end`
+    static const char* close_comment(const char* p, const char* end){
+        while (true) {
+            const char* star = find(p, end, '*');
+            if (star + 1 >= end) {
+                return nullptr;
+            }
+            if (star[1] == '/') {
+                return star + 2;
+            }
+            p = star + 1;
+        }
+    }
+
+    // Follows the comment delimiters the way Tokenizer does: outside a comment, a `/` can only start
+    // a line comment, a block comment or a division, since no other token contains one
+    static bool ends_open(const char* p, const char* end, bool open){
+        while (p < end) {
+            if (open) {
+                p = close_comment(p, end);
+                if (p == nullptr) {
+                    return true;
+                }
+                open = false;
+                continue;
+            }
+            const char* slash = find(p, end, '/');
+            if (slash + 1 >= end) {
+                return false;
+            }
+            if (slash[1] == '/') {
+                p = find(slash + 2, end, '\n');
+            }
+            else if (slash[1] == '*') {
+                p = slash + 2;
+                open = true;
+            }
+            else {
+                p = slash + 1;
+            }
+        }
+        return open;
+    }
+
+    void scan_chunk(Chunk& chunk) const{
+        const char* begin = m_src.data() + chunk.begin;
+        const char* end = m_src.data() + chunk.end;
+        chunk.ends_open[0] = ends_open(begin, end, false);
+        chunk.ends_open[1] = ends_open(begin, end, true);
+        chunk.newlines = static_cast<int>(std::count(begin, end, '\n'));
+    }
+
+    // Tasks must not throw, so an error is kept for the parser, along with the tokens before it
+    void lex_chunk(Chunk& chunk) const{
+        try {
+            size_t start = chunk.begin;
+            int line = chunk.line;
+            if (chunk.starts_open) {
+                const char* begin = m_src.data() + chunk.begin;
+                const char* end = m_src.data() + chunk.end;
+                const char* after = close_comment(begin, end);
+                if (after == nullptr) {
+                    return;
+                }
+                start = static_cast<size_t>(after - m_src.data());
+                line += static_cast<int>(std::count(begin, after, '\n'));
+            }
+            // Cutting the text off at the chunk's end keeps token offsets relative to the whole source
+            Tokenizer(m_src.substr(0, chunk.end), chunk.interner, start, line).tokenize(chunk.tokens);
+        }
+        catch (...) {
+            chunk.error = std::current_exception();
+        }
+    }
+
+    void rename_symbols(Chunk& chunk) const{
+        for (Token& token : chunk.tokens) {
+            if (token.type == TokenType::ident) {
+                token.symbol = chunk.symbols[token.symbol];
+                token.value = m_interner.name(token.symbol);
+            }
+        }
+    }
+};
@@ -1,162 +1,57 @@
 #pragma once
-#include <variant>
-
-#include "arena.h"
+#include <array>
+#include <cassert>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "ast.h"
+#include "error.h"
 #include "tokenizer.h"
 
-struct NodeTermIntLit{
-    Token int_lit;
-};
-
-struct NodeTermIdent{
-    Token ident;
-};
-
-struct NodeExpr;
-
-struct NodeTermParen{
-    NodeExpr* expr;
-};
-
-struct NodeBinExprAdd{
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprMulti{
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprSub{
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprDiv{
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExpr{
-    std::variant<NodeBinExprMulti*, NodeBinExprAdd*, NodeBinExprDiv*, NodeBinExprSub*> var;
-};
-
-struct NodeTerm{
-    std::variant<NodeTermIntLit*, NodeTermIdent*, NodeTermParen*> var;
-};
-
-struct NodeExpr{
-    std::variant<NodeTerm*, NodeBinExpr*> var;
-};
-
-
-struct NodeStmtExit{
-    NodeExpr* expr;
-};
-
-struct NodeStmtLet{
-    Token ident;
-    NodeExpr* expr{};
-};
-
-struct NodeStmt;
-
-struct NodeScope{
-    std::vector<NodeStmt*> stmts;
-};
-
-struct NodeIfPred;
-
-struct NodeIfPredElif{
-    NodeExpr* expr;
-    NodeScope* scope;
-    std::optional<NodeIfPred*> pred;
-};
-
-struct NodeIfPredElse{
-    NodeScope* scope;
-};
-
-struct NodeIfPred{
-    std::variant<NodeIfPredElif*, NodeIfPredElse*> var;
-};
-
-struct NodeStmtIf{
-    NodeExpr* expr;
-    NodeScope* scope;
-    std::optional<NodeIfPred*> pred;
-};
-
-struct NodeStmtAssign{
-    Token ident;
-    NodeExpr* expr;
-};
-
-struct NodeStmt{
-    std::variant<NodeStmtExit*, NodeStmtLet*, NodeScope*, NodeStmtIf*, NodeStmtAssign*> var;
-};
-
-struct NodeProg{
-    std::vector<NodeStmt*> stmts;
-};
-
 class Parser{
 public:
-    explicit Parser(std::vector<Token> tokens)
-        : m_tokens(std::move(tokens)),
-          m_allocator(1024 * 1024 * 4) // 4mb
+    explicit Parser(Tokenizer tokenizer)
+        : m_tokenizer(std::move(tokenizer))
     {}
 
-    std::optional<NodeBinExpr*> parse_bin_expr(){
-        if (parse_expr()) {
-            std::cerr << "Unsupported binary operator" << std::endl;
-            exit(EXIT_FAILURE);
-        }
-        return {};
-    }
+    // Parses onto the end of an existing AST, leaving its nodes where they are
+    Parser(Tokenizer tokenizer, Ast ast)
+        : m_tokenizer(std::move(tokenizer)),
+          m_ast(std::move(ast))
+    {}
 
-    void error_expected(const std::string& msg) const{
-        std::cerr << "[Parser Error] Expected " << msg << " on line " << peek(-1).value().line << std::endl;
-        exit(EXIT_FAILURE);
+    // Parses tokens that were lexed up front, e.g. by ParallelLexer, reading the streams in order
+    explicit Parser(std::vector<TokenStream> streams)
+        : m_streams(std::move(streams))
+    {}
+
+    [[noreturn]] void error_expected(const std::string& msg) const{
+        compile_error("[Parser Error] Expected " + msg + " on line " + std::to_string(m_prev_line));
     }
 
-    std::optional<NodeTerm*> parse_term(){
+    std::optional<ExprId> parse_term(){
         if (const auto int_lit = try_consume(TokenType::int_literal)) {
-            auto* term_int_lit = m_allocator.alloc<NodeTermIntLit>();
-            term_int_lit->int_lit = int_lit.value();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_int_lit;
-            return term;
+            return m_ast.add_int_lit(int_lit_value(int_lit.value()));
         }
         if (const auto ident = try_consume(TokenType::ident)) {
-            auto* term_ident = m_allocator.alloc<NodeTermIdent>();
-            term_ident->ident = ident.value();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_ident;
-            return term;
+            return m_ast.add_ident({.symbol = ident->symbol, .line = ident->line});
         }
         if (const auto open_paren = try_consume(TokenType::open_paren)) {
+            // Parentheses only group, so they leave no node behind
             const auto expr = parse_expr();
             if (!expr.has_value()) {
                 error_expected("expression");
             }
             try_consume_error(TokenType::close_paren);
-            auto term_paren = m_allocator.alloc<NodeTermParen>();
-            term_paren->expr = expr.value();
-            auto term = m_allocator.alloc<NodeTerm>();
-            term->var = term_paren;
-            return term;
+            return expr;
         }
         return {};
     }
 
-    std::optional<NodeExpr*> parse_expr(int const min_prec = 0){
-        std::optional<NodeTerm*> term_lhs = parse_term();
-        if (!term_lhs.has_value()) return {};
-
-        auto expr_lhs = m_allocator.alloc<NodeExpr>();
-        expr_lhs->var = term_lhs.value();
+    std::optional<ExprId> parse_expr(int const min_prec = 0){
+        std::optional<ExprId> expr_lhs = parse_term();
+        if (!expr_lhs.has_value()) return {};
 
         while (true) {
             std::optional<Token> curr_tok = peek();
@@ -166,105 +61,75 @@ public:
                 if (!prec.has_value() || prec < min_prec) break;
             }
             else break;
-            auto [type, line, value] = consume();
+            const TokenType type = consume().type;
             const int next_min_prec = prec.value() + 1;
             auto expr_rhs = parse_expr(next_min_prec);
             if (!expr_rhs.has_value()) {
                 error_expected("expression");
             }
 
-            auto expr = m_allocator.alloc<NodeBinExpr>();
-            auto const expr_lhs2 = m_allocator.alloc<NodeExpr>();
+            ExprKind kind;
             if (type == TokenType::plus) {
-                auto add = m_allocator.alloc<NodeBinExprAdd>();
-                expr_lhs2->var = expr_lhs->var;
-                add->lhs = expr_lhs2;
-                add->rhs = expr_rhs.value();
-                expr->var = add;
+                kind = ExprKind::add;
             }
             else if (type == TokenType::star) {
-                auto multi = m_allocator.alloc<NodeBinExprMulti>();
-                expr_lhs2->var = expr_lhs->var;
-                multi->lhs = expr_lhs2;
-                multi->rhs = expr_rhs.value();
-                expr->var = multi;
+                kind = ExprKind::mul;
             }
             else if (type == TokenType::minus) {
-                auto sub = m_allocator.alloc<NodeBinExprSub>();
-                expr_lhs2->var = expr_lhs->var;
-                sub->lhs = expr_lhs2;
-                sub->rhs = expr_rhs.value();
-                expr->var = sub;
+                kind = ExprKind::sub;
             }
-            else if (type == TokenType::fslash) {
-                auto div = m_allocator.alloc<NodeBinExprDiv>();
-                expr_lhs2->var = expr_lhs->var;
-                div->lhs = expr_lhs2;
-                div->rhs = expr_rhs.value();
-                expr->var = div;
+            else {
+                assert(type == TokenType::fslash);
+                kind = ExprKind::div;
             }
-            expr_lhs->var = expr;
+            expr_lhs = m_ast.add_bin(kind, expr_lhs.value(), expr_rhs.value());
         }
 
         return expr_lhs;
     }
 
-    std::optional<NodeScope*> parse_scope(){
+    // Statements of nested scopes are parsed onto a shared stack and copied out as one contiguous
+    // list once their scope closes
+    std::optional<BodyId> parse_scope(){
         if (!try_consume(TokenType::open_curly).has_value()) return {};
-        auto scope = m_allocator.alloc<NodeScope>();
+        const size_t mark = m_stmt_stack.size();
         while (auto stmt = parse_stmt()) {
-            scope->stmts.push_back(stmt.value());
+            m_stmt_stack.push_back(stmt.value());
         }
         try_consume_error(TokenType::close_curly);
-        return scope;
+        return pop_body(mark);
     }
 
-    std::optional<NodeIfPred*> parse_if_pred(){
-        if (try_consume(TokenType::elif)) {
-            try_consume_error(TokenType::open_paren);
-            auto const elif = m_allocator.alloc<NodeIfPredElif>();
-            if (auto const expr = parse_expr()) {
-                elif->expr = expr.value();
-            }
-            else {
-                error_expected("expression");
-            }
-
-            try_consume_error(TokenType::close_paren);
-            if (auto const scope = parse_scope()) {
-                elif->scope = scope.value();
-            }
-            else {
-                error_expected("scope");
-            }
-            elif->pred = parse_if_pred();
-            auto pred = m_allocator.alloc<NodeIfPred>();
-            pred->var = elif;
-            return pred;
+    // Parses the condition and scope of an if or elif arm, or of a while loop
+    Arm parse_arm(){
+        try_consume_error(TokenType::open_paren);
+        ExprId cond = no_expr;
+        if (auto const expr = parse_expr()) {
+            cond = expr.value();
         }
-        if (try_consume(TokenType::else_)) {
-            const auto else_ = m_allocator.alloc<NodeIfPredElse>();
-            if (const auto scope = parse_scope()) {
-                else_->scope = scope.value();
-            }
-            else {
-                error_expected("scope");
-            }
-            const auto pred = m_allocator.alloc<NodeIfPred>();
-            pred->var = else_;
-            return pred;
+        else {
+            error_expected("expression");
+        }
+        try_consume_error(TokenType::close_paren);
+        return {.cond = cond, .body = parse_arm_scope()};
+    }
+
+    BodyId parse_arm_scope(){
+        if (auto const scope = parse_scope()) {
+            return scope.value();
         }
+        error_expected("scope");
         return {};
     }
 
-    std::optional<NodeStmt*> parse_stmt(){
+    std::optional<StmtId> parse_stmt(){
         if (peek().has_value() && peek().value().type == TokenType::exit && peek(1).has_value()
             && peek(1)->type == TokenType::open_paren) {
             consume();
             consume();
-            auto stmt_exit = m_allocator.alloc<NodeStmtExit>();
+            ExprId expr = no_expr;
             if (const auto node_expr = parse_expr()) {
-                stmt_exit->expr = node_expr.value();
+                expr = node_expr.value();
             }
             else {
                 error_expected("expression");
@@ -273,9 +138,7 @@ public:
             try_consume_error(TokenType::close_paren);
             try_consume_error(TokenType::semicolon);
 
-            auto stmt = m_allocator.alloc<NodeStmt>();
-            stmt->var = stmt_exit;
-            return stmt;
+            return m_ast.add_exit(expr);
         }
         if (
             peek().has_value() && peek()->type == TokenType::let
@@ -283,102 +146,161 @@ public:
             && peek(2).has_value() && peek(2)->type == TokenType::eq
         ) {
             consume();
-            auto stmt_let = m_allocator.alloc<NodeStmtLet>();
-            stmt_let->ident = consume();
-            consume();
-            if (const auto expr = parse_expr()) {
-                stmt_let->expr = expr.value();
-            }
-            else {
-                error_expected("expression");
-            }
-
-            try_consume_error(TokenType::semicolon);
-
-            auto stmt = m_allocator.alloc<NodeStmt>();
-            stmt->var = stmt_let;
-            return stmt;
+            return parse_store(StmtKind::let);
         }
 
         if (peek().has_value() && peek()->type == TokenType::ident
             && peek(1).has_value() && peek(1)->type == TokenType::eq) {
-            const auto assign = m_allocator.alloc<NodeStmtAssign>();
-            assign->ident = consume();
-            consume();
-            if (const auto expr = parse_expr()) {
-                assign->expr = expr.value();
-            }
-            else {
-                error_expected("expression");
-            }
-            try_consume_error(TokenType::semicolon);
-            const auto stmt = m_allocator.alloc<NodeStmt>();
-            stmt->var = assign;
-            return stmt;
+            return parse_store(StmtKind::assign);
         }
 
         if (peek().has_value() && peek()->type == TokenType::open_curly) {
             if (auto scope = parse_scope()) {
-                auto stmt = m_allocator.alloc<NodeStmt>();
-                stmt->var = scope.value();
-                return stmt;
+                return m_ast.add_scope(scope.value());
             }
             error_expected("scope");
         }
 
         if (auto if_ = try_consume(TokenType::if_)) {
-            try_consume_error(TokenType::open_paren);
-            auto const stmt_if = m_allocator.alloc<NodeStmtIf>();
-            if (auto const expr = parse_expr()) {
-                stmt_if->expr = expr.value();
-            }
-            else {
-                error_expected("expression");
-            }
-            try_consume_error(TokenType::close_paren);
-            if (auto const scope = parse_scope()) {
-                stmt_if->scope = scope.value();
+            const size_t mark = m_arm_stack.size();
+            m_arm_stack.push_back(parse_arm());
+            while (true) {
+                if (try_consume(TokenType::elif)) {
+                    m_arm_stack.push_back(parse_arm());
+                    continue;
+                }
+                if (try_consume(TokenType::else_)) {
+                    m_arm_stack.push_back({.cond = no_expr, .body = parse_arm_scope()});
+                }
+                break;
             }
-            else {
-                error_expected("scope");
-            }
-            stmt_if->pred = parse_if_pred();
-            auto stmt = m_allocator.alloc<NodeStmt>();
-            stmt->var = stmt_if;
+            const StmtId stmt = m_ast.add_if(std::span(m_arm_stack).subspan(mark));
+            m_arm_stack.resize(mark);
             return stmt;
         }
 
+        if (try_consume(TokenType::while_)) {
+            const Arm loop = parse_arm();
+            return m_ast.add_while(loop.cond, loop.body);
+        }
+
         return {};
     }
 
-    std::optional<NodeProg> parse_prog(){
-        NodeProg prog;
+    std::optional<Ast> parse_prog(){
         while (peek().has_value()) {
             if (auto stmt = parse_stmt()) {
-                prog.stmts.push_back(stmt.value());
+                m_stmt_stack.push_back(stmt.value());
             }
             else {
-                std::cerr << "Invalid statement" << std::endl;
-                exit(EXIT_FAILURE);
+                compile_error("Invalid statement");
             }
         }
-        return prog;
+        m_ast.root = pop_body(0);
+        return std::move(m_ast);
+    }
+
+    // The pieces of parse_prog(), for callers that parse top-level statements one at a time
+
+    [[nodiscard]] std::optional<Token> next_token(){
+        return peek();
+    }
+
+    // Source offset just past the last consumed token, and that token's line
+    [[nodiscard]] uint32_t consumed_end() const{
+        return m_prev_end;
+    }
+
+    [[nodiscard]] int consumed_line() const{
+        return m_prev_line;
+    }
+
+    Ast take_ast(){
+        return std::move(m_ast);
     }
 
 private:
-    const std::vector<Token> m_tokens;
-    size_t m_index = 0;
-    ArenaAllocator m_allocator;
+    // The grammar never looks more than three tokens ahead, so tokens are pulled from the tokenizer
+    // into a small ring as needed rather than materialized up front
+    static constexpr size_t lookahead = 4;
+
+    std::optional<Tokenizer> m_tokenizer{};
+    // Used instead of the tokenizer when there is none
+    std::vector<TokenStream> m_streams{};
+    size_t m_stream = 0;
+    size_t m_next_token = 0;
+    std::array<Token, lookahead> m_ring{};
+    size_t m_head = 0;
+    size_t m_count = 0;
+    bool m_eof = false;
+    int m_prev_line = 1;
+    uint32_t m_prev_end = 0;
+    Ast m_ast{};
+    std::vector<StmtId> m_stmt_stack{};
+    std::vector<Arm> m_arm_stack{};
+
+    // Handles `ident = expr;` for both let (whose keyword is already consumed) and assignment
+    StmtId parse_store(const StmtKind kind){
+        const Token ident = consume();
+        consume();
+        ExprId expr = no_expr;
+        if (const auto node_expr = parse_expr()) {
+            expr = node_expr.value();
+        }
+        else {
+            error_expected("expression");
+        }
+        try_consume_error(TokenType::semicolon);
+        return m_ast.add_store(kind, {.ident = {.symbol = ident.symbol, .line = ident.line}, .expr = expr});
+    }
+
+    BodyId pop_body(const size_t mark){
+        const BodyId body = m_ast.add_body(std::span(m_stmt_stack).subspan(mark));
+        m_stmt_stack.resize(mark);
+        return body;
+    }
+
+    std::optional<Token> pull(){
+        if (m_tokenizer.has_value()) {
+            return m_tokenizer->next();
+        }
+        while (m_stream < m_streams.size()) {
+            const TokenStream& stream = m_streams[m_stream];
+            if (m_next_token < stream.tokens.size()) {
+                return stream.tokens[m_next_token++];
+            }
+            if (stream.error != nullptr) {
+                std::rethrow_exception(stream.error);
+            }
+            m_stream++;
+            m_next_token = 0;
+        }
+        return {};
+    }
 
-    [[nodiscard]] std::optional<Token> peek(const int offset = 0) const{
-        if (m_index + offset >= m_tokens.size()) {
+    [[nodiscard]] std::optional<Token> peek(const size_t offset = 0){
+        assert(offset < lookahead);
+        while (m_count <= offset && !m_eof) {
+            if (const std::optional<Token> token = pull()) {
+                m_ring[(m_head + m_count++) % lookahead] = token.value();
+            }
+            else {
+                m_eof = true;
+            }
+        }
+        if (offset >= m_count) {
             return {};
         }
-        return m_tokens.at(m_index + offset);
+        return m_ring[(m_head + offset) % lookahead];
     }
 
     Token consume(){
-        return m_tokens.at(m_index++);
+        const Token token = peek().value();
+        m_head = (m_head + 1) % lookahead;
+        m_count--;
+        m_prev_line = token.line;
+        m_prev_end = token.end;
+        return token;
     }
 
     std::optional<Token> try_consume(const TokenType type){
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "asm.h"
+
+// Peephole optimizer over the register-allocated instruction list. Each pattern looks at an
+// instruction and the few after it and rewrites them in place; removed instructions are only marked
+// while a sweep runs, so indices stay stable, and sweeps repeat until no pattern applies. Patterns only
+// ever produce operand combinations the Encoder accepts.
+class Peephole{
+    using Pattern = bool (Peephole::*)(size_t);
+
+public:
+    explicit Peephole(std::vector<Instr> instrs)
+        : m_instrs(std::move(instrs))
+    {}
+
+    [[nodiscard]] std::vector<Instr> run(){
+        static constexpr Pattern patterns[] = {
+            &Peephole::self_move,
+            &Peephole::forward_move,
+            &Peephole::thread_jump,
+            &Peephole::invert_branch,
+            &Peephole::jump_to_next,
+            &Peephole::unreachable,
+        };
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            m_removed.assign(m_instrs.size(), false);
+            index_labels();
+            for (size_t i = 0; i < m_instrs.size(); i++) {
+                for (const Pattern pattern : patterns) {
+                    if (!m_removed[i] && (this->*pattern)(i)) {
+                        changed = true;
+                    }
+                }
+            }
+            compact();
+        }
+        return std::move(m_instrs);
+    }
+
+private:
+    std::vector<Instr> m_instrs;
+    std::vector<bool> m_removed{};
+    std::vector<size_t> m_label_pos{};
+
+    void index_labels(){
+        for (size_t i = 0; i < m_instrs.size(); i++) {
+            if (m_instrs[i].op == Op::label) {
+                const auto id = static_cast<size_t>(m_instrs[i].dst.imm);
+                if (id >= m_label_pos.size()) {
+                    m_label_pos.resize(id + 1, SIZE_MAX);
+                }
+                m_label_pos[id] = i;
+            }
+        }
+    }
+
+    void compact(){
+        size_t out = 0;
+        for (size_t i = 0; i < m_instrs.size(); i++) {
+            if (!m_removed[i]) {
+                m_instrs[out++] = m_instrs[i];
+            }
+        }
+        m_instrs.resize(out);
+    }
+
+    [[nodiscard]] size_t next(size_t i) const{
+        do {
+            i++;
+        } while (i < m_instrs.size() && m_removed[i]);
+        return i;
+    }
+
+    [[nodiscard]] bool is(const size_t i, const Op op) const{
+        return i < m_instrs.size() && m_instrs[i].op == op;
+    }
+
+    [[nodiscard]] static bool is_jump(const Op op){
+        return op == Op::jmp || op == Op::je || op == Op::jne;
+    }
+
+    // Whether control reaching `i` falls into the label `label` without executing anything
+    [[nodiscard]] bool falls_into(size_t i, const int64_t label) const{
+        for (; is(i, Op::label) || is(i, Op::comment); i = next(i)) {
+            if (m_instrs[i].op == Op::label && m_instrs[i].dst.imm == label) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The first instruction executed after jumping to `label`
+    [[nodiscard]] size_t target_of(const int64_t label) const{
+        size_t i = m_label_pos[label];
+        while (is(i, Op::label) || is(i, Op::comment) || (i < m_instrs.size() && m_removed[i])) {
+            i++;
+        }
+        return i;
+    }
+
+    static bool on_reg(const Operand& operand, const Reg reg){
+        return (operand.kind == Operand::Kind::reg || operand.kind == Operand::Kind::mem) && operand.reg == reg;
+    }
+
+    static bool is_int32(const Operand& operand){
+        return operand.imm >= INT32_MIN && operand.imm <= INT32_MAX;
+    }
+
+    // Mirrors the operand forms the Encoder has encodings for
+    static bool encodable(const Instr& instr){
+        using Kind = Operand::Kind;
+        const Kind dst = instr.dst.kind;
+        const Kind src = instr.src.kind;
+        const bool dst_rm = dst == Kind::reg || dst == Kind::mem;
+        switch (instr.op) {
+        case Op::mov:
+            if (dst == Kind::reg && src == Kind::imm) {
+                return true;
+            }
+            [[fallthrough]];
+        case Op::add:
+        case Op::sub:
+        case Op::xor_:
+        case Op::cmp:
+            return (dst_rm && src == Kind::reg) || (dst == Kind::reg && src == Kind::mem)
+                || (dst_rm && src == Kind::imm && is_int32(instr.src));
+        case Op::shl:
+        case Op::shr:
+            return dst_rm && src == Kind::imm && instr.src.imm >= 0 && instr.src.imm <= 63;
+        case Op::mul:
+        case Op::div:
+            return dst_rm;
+        default:
+            return false;
+        }
+    }
+
+    // Registers an instruction reads, including memory bases and implicit operands
+    static bool reads(const Instr& instr, const Reg reg){
+        switch (instr.op) {
+        case Op::mov:
+            return on_reg(instr.src, reg) || (instr.dst.kind == Operand::Kind::mem && instr.dst.reg == reg);
+        case Op::xor_:
+            // xor r, r only zeroes r
+            if (instr.dst.kind == Operand::Kind::reg && instr.dst == instr.src) {
+                return false;
+            }
+            [[fallthrough]];
+        case Op::add:
+        case Op::sub:
+        case Op::shl:
+        case Op::shr:
+        case Op::cmp:
+            return on_reg(instr.dst, reg) || on_reg(instr.src, reg);
+        case Op::mul:
+            return on_reg(instr.dst, reg) || reg == Reg::rax;
+        case Op::div:
+            return on_reg(instr.dst, reg) || reg == Reg::rax || reg == Reg::rdx;
+        case Op::syscall:
+            // The only syscall emitted is exit, which takes its code in rdi
+            return reg == Reg::rax || reg == Reg::rdi;
+        case Op::ret:
+            return reg == Reg::rax || reg == Reg::rsp;
+        default:
+            return false;
+        }
+    }
+
+    static bool writes(const Instr& instr, const Reg reg){
+        switch (instr.op) {
+        case Op::mov:
+        case Op::add:
+        case Op::sub:
+        case Op::xor_:
+        case Op::shl:
+        case Op::shr:
+            return instr.dst.kind == Operand::Kind::reg && instr.dst.reg == reg;
+        case Op::mul:
+        case Op::div:
+            return reg == Reg::rax || reg == Reg::rdx;
+        case Op::syscall:
+            return reg == Reg::rax || reg == Reg::rcx || reg == Reg::r11;
+        default:
+            return false;
+        }
+    }
+
+    // Whether `reg` is overwritten before it is read again, looking no further than straight-line code.
+    // Anything that might be a jump target or a jump counts as a read.
+    [[nodiscard]] bool dead_after(const size_t i, const Reg reg) const{
+        for (size_t j = next(i); j < m_instrs.size(); j = next(j)) {
+            const Instr& instr = m_instrs[j];
+            if (reads(instr, reg)) {
+                return false;
+            }
+            if (writes(instr, reg) || instr.op == Op::syscall || instr.op == Op::ret) {
+                return true;
+            }
+            if (instr.op == Op::label || is_jump(instr.op)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // mov x, x
+    bool self_move(const size_t i){
+        const Instr& instr = m_instrs[i];
+        if (instr.op == Op::mov && instr.dst == instr.src) {
+            m_removed[i] = true;
+            return true;
+        }
+        return false;
+    }
+
+    // mov r, x; op ..., r  =>  op ..., x  when r isn't read again. This folds immediates and memory
+    // operands into the instruction that consumes them and drops copies through scratch registers.
+    bool forward_move(const size_t i){
+        const Instr& mov = m_instrs[i];
+        const size_t j = next(i);
+        if (mov.op != Op::mov || mov.dst.kind != Operand::Kind::reg || j >= m_instrs.size()) {
+            return false;
+        }
+        const Reg reg = mov.dst.reg;
+        Instr user = m_instrs[j];
+        switch (user.op) {
+        case Op::mov:
+        case Op::add:
+        case Op::sub:
+        case Op::xor_:
+        case Op::cmp:
+            if (user.src != mov.dst || on_reg(user.dst, reg)) {
+                return false;
+            }
+            user.src = mov.src;
+            break;
+        case Op::mul:
+        case Op::div:
+            if (user.dst != mov.dst || reg == Reg::rax || reg == Reg::rdx) {
+                return false;
+            }
+            user.dst = mov.src;
+            break;
+        default:
+            return false;
+        }
+        if (reg == Reg::rsp || !encodable(user) || !dead_after(j, reg)) {
+            return false;
+        }
+        m_instrs[j] = user;
+        m_removed[i] = true;
+        return true;
+    }
+
+    // A jump to a label that is followed by another jump goes to that jump's target instead
+    bool thread_jump(const size_t i){
+        Instr& jump = m_instrs[i];
+        if (!is_jump(jump.op)) {
+            return false;
+        }
+        const size_t target = target_of(jump.dst.imm);
+        if (!is(target, Op::jmp) || m_instrs[target].dst == jump.dst || target == i) {
+            return false;
+        }
+        // A cycle of jumps would otherwise keep retargeting forever
+        std::vector<int64_t> seen{jump.dst.imm};
+        for (int64_t label = m_instrs[target].dst.imm;; label = m_instrs[target_of(label)].dst.imm) {
+            if (std::find(seen.begin(), seen.end(), label) != seen.end()) {
+                return false;
+            }
+            if (!is(target_of(label), Op::jmp)) {
+                break;
+            }
+            seen.push_back(label);
+        }
+        jump.dst = m_instrs[target].dst;
+        return true;
+    }
+
+    // je a; jmp b; a:  =>  jne b; a:  (and the other way around)
+    bool invert_branch(const size_t i){
+        const Instr& branch = m_instrs[i];
+        const size_t j = next(i);
+        if ((branch.op != Op::je && branch.op != Op::jne) || !is(j, Op::jmp) || !falls_into(next(j), branch.dst.imm)) {
+            return false;
+        }
+        m_instrs[i] = {.op = branch.op == Op::je ? Op::jne : Op::je, .dst = m_instrs[j].dst};
+        m_removed[j] = true;
+        return true;
+    }
+
+    // A jump to the label right after it
+    bool jump_to_next(const size_t i){
+        if (!is_jump(m_instrs[i].op) || !falls_into(next(i), m_instrs[i].dst.imm)) {
+            return false;
+        }
+        m_removed[i] = true;
+        return true;
+    }
+
+    // Code after a jmp or ret that no label leads to
+    bool unreachable(const size_t i){
+        if (!is(i, Op::jmp) && !is(i, Op::ret)) {
+            return false;
+        }
+        bool removed = false;
+        for (size_t j = next(i); j < m_instrs.size() && m_instrs[j].op != Op::label; j = next(j)) {
+            m_removed[j] = true;
+            removed = true;
+        }
+        return removed;
+    }
+};
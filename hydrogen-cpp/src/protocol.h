@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Wire format between hydro-client and `hydro --serve`, over a Unix stream socket carrying one request
+// per connection. Every message is a frame: a native-endian uint32 length and then that many bytes.
+//   request:  the client's working directory, then each argument, all NUL-terminated
+//   response: a uint32 exit status followed by everything the command printed
+// Only used locally, so nothing here cares about byte order.
+namespace protocol {
+
+inline std::string default_socket_path(){
+    if (const char* path = std::getenv("HYDRO_SOCKET")) {
+        return path;
+    }
+    return "/tmp/hydro-" + std::to_string(::getuid()) + ".sock";
+}
+
+inline std::optional<sockaddr_un> socket_address(const std::string& path){
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        return std::nullopt;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+inline bool write_all(const int fd, const char* data, size_t size){
+    while (size > 0) {
+        const ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool read_all(const int fd, char* data, size_t size){
+    while (size > 0) {
+        const ssize_t n = ::read(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool write_frame(const int fd, const std::string& payload){
+    const auto size = static_cast<uint32_t>(payload.size());
+    return write_all(fd, reinterpret_cast<const char*>(&size), sizeof(size))
+        && write_all(fd, payload.data(), payload.size());
+}
+
+// Frames bigger than `max_size` are refused rather than allocated
+inline std::optional<std::string> read_frame(const int fd, const uint32_t max_size = 64 * 1024 * 1024){
+    uint32_t size;
+    if (!read_all(fd, reinterpret_cast<char*>(&size), sizeof(size)) || size > max_size) {
+        return std::nullopt;
+    }
+    std::string payload(size, '\0');
+    if (!read_all(fd, payload.data(), size)) {
+        return std::nullopt;
+    }
+    return payload;
+}
+
+inline std::string encode_request(const std::string& cwd, const std::vector<std::string>& args){
+    std::string payload = cwd;
+    payload += '\0';
+    for (const std::string& arg : args) {
+        payload += arg;
+        payload += '\0';
+    }
+    return payload;
+}
+
+struct Request{
+    std::string cwd;
+    std::vector<std::string> args;
+};
+
+inline std::optional<Request> decode_request(const std::string& payload){
+    if (payload.empty() || payload.back() != '\0') {
+        return std::nullopt;
+    }
+    std::vector<std::string> fields;
+    size_t begin = 0;
+    while (begin < payload.size()) {
+        const size_t end = payload.find('\0', begin);
+        fields.emplace_back(payload, begin, end - begin);
+        begin = end + 1;
+    }
+    return Request{
+        .cwd = std::move(fields[0]),
+        .args = {std::make_move_iterator(fields.begin() + 1), std::make_move_iterator(fields.end())},
+    };
+}
+
+inline std::string encode_response(const int status, const std::string& output){
+    std::string payload(sizeof(uint32_t), '\0');
+    const auto code = static_cast<uint32_t>(status);
+    std::memcpy(payload.data(), &code, sizeof(code));
+    return payload + output;
+}
+
+struct Response{
+    int status;
+    std::string output;
+};
+
+inline std::optional<Response> decode_response(const std::string& payload){
+    if (payload.size() < sizeof(uint32_t)) {
+        return std::nullopt;
+    }
+    uint32_t code;
+    std::memcpy(&code, payload.data(), sizeof(code));
+    return Response{.status = static_cast<int>(code), .output = payload.substr(sizeof(code))};
+}
+
+}
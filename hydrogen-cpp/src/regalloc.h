@@ -0,0 +1,338 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "asm.h"
+
+// Linear scan register allocation over Generator's vreg instruction list. Positions are doubled so
+// that an instruction reads its operands at 2i and writes its result at 2i + 1, which lets a value
+// that dies in an instruction hand its register over to the value that instruction defines.
+// rax and rdx are kept out of the pool since mul/div use them implicitly, and rax doubles as the
+// scratch register when an instruction ends up with two memory operands after spilling.
+class RegAlloc{
+public:
+    static constexpr Reg pool[] = {
+        Reg::rbx, Reg::rcx, Reg::rsi, Reg::rdi, Reg::r8, Reg::r9,
+        Reg::r10, Reg::r11, Reg::r12, Reg::r13, Reg::r14, Reg::r15
+    };
+
+    RegAlloc(std::vector<Instr> instrs, const size_t vreg_count)
+        : m_instrs(std::move(instrs)),
+          m_vreg_count(vreg_count),
+          m_intervals(vreg_count)
+    {}
+
+    [[nodiscard]] std::vector<Instr> alloc(){
+        build_blocks();
+        compute_liveness();
+        build_intervals();
+        linear_scan();
+        return rewrite();
+    }
+
+    [[nodiscard]] size_t spill_slots() const{
+        return m_spill_slots;
+    }
+
+private:
+    struct Interval{
+        size_t start = SIZE_MAX;
+        size_t end = 0;
+        size_t uses = 0; // weighted by loop depth
+        std::optional<Reg> reg{};
+        size_t slot = 0;
+    };
+
+    struct Block{
+        size_t start;
+        size_t end;
+        std::vector<size_t> succs{};
+        std::vector<uint64_t> use{};
+        std::vector<uint64_t> def{};
+        std::vector<uint64_t> live_in{};
+        std::vector<uint64_t> live_out{};
+    };
+
+    std::vector<Instr> m_instrs;
+    size_t m_vreg_count;
+    std::vector<Interval> m_intervals;
+    std::vector<Block> m_blocks{};
+    size_t m_spill_slots = 0;
+
+    static bool test(const std::vector<uint64_t>& set, const size_t bit){
+        return set[bit / 64] >> (bit % 64) & 1;
+    }
+
+    static void set(std::vector<uint64_t>& set, const size_t bit){
+        set[bit / 64] |= uint64_t{1} << (bit % 64);
+    }
+
+    static bool reads_dst(const Op op){
+        switch (op) {
+        case Op::add:
+        case Op::sub:
+        case Op::xor_:
+        case Op::shl:
+        case Op::shr:
+        case Op::cmp:
+        case Op::mul:
+        case Op::div:
+        case Op::push:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool writes_dst(const Op op){
+        switch (op) {
+        case Op::mov:
+        case Op::add:
+        case Op::sub:
+        case Op::xor_:
+        case Op::shl:
+        case Op::shr:
+        case Op::pop:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static bool ends_block(const Op op){
+        return op == Op::je || op == Op::jne || op == Op::jmp;
+    }
+
+    void build_blocks(){
+        std::vector<size_t> label_block;
+        size_t start = 0;
+        for (size_t i = 0; i < m_instrs.size(); i++) {
+            const Instr& instr = m_instrs[i];
+            if (instr.op == Op::label && i != start) {
+                m_blocks.push_back({.start = start, .end = i});
+                start = i;
+            }
+            if (instr.op == Op::label) {
+                const auto id = static_cast<size_t>(instr.dst.imm);
+                if (id >= label_block.size()) {
+                    label_block.resize(id + 1);
+                }
+                label_block[id] = m_blocks.size();
+            }
+            if (ends_block(instr.op)) {
+                m_blocks.push_back({.start = start, .end = i + 1});
+                start = i + 1;
+            }
+        }
+        if (start < m_instrs.size() || m_blocks.empty()) {
+            m_blocks.push_back({.start = start, .end = m_instrs.size()});
+        }
+
+        const size_t words = (m_vreg_count + 63) / 64;
+        for (size_t b = 0; b < m_blocks.size(); b++) {
+            Block& block = m_blocks[b];
+            block.use.assign(words, 0);
+            block.def.assign(words, 0);
+            block.live_in.assign(words, 0);
+            block.live_out.assign(words, 0);
+
+            const Op last = block.end > block.start ? m_instrs[block.end - 1].op : Op::comment;
+            if (ends_block(last)) {
+                block.succs.push_back(label_block[m_instrs[block.end - 1].dst.imm]);
+            }
+            if (last != Op::jmp && b + 1 < m_blocks.size()) {
+                block.succs.push_back(b + 1);
+            }
+
+            for (size_t i = block.start; i < block.end; i++) {
+                const Instr& instr = m_instrs[i];
+                if (instr.src.kind == Operand::Kind::vreg && !test(block.def, instr.src.imm)) {
+                    set(block.use, instr.src.imm);
+                }
+                if (instr.dst.kind == Operand::Kind::vreg) {
+                    if (reads_dst(instr.op) && !test(block.def, instr.dst.imm)) {
+                        set(block.use, instr.dst.imm);
+                    }
+                    if (writes_dst(instr.op)) {
+                        set(block.def, instr.dst.imm);
+                    }
+                }
+            }
+        }
+    }
+
+    void compute_liveness(){
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t b = m_blocks.size(); b-- > 0;) {
+                Block& block = m_blocks[b];
+                for (size_t w = 0; w < block.live_out.size(); w++) {
+                    uint64_t out = 0;
+                    for (const size_t succ : block.succs) {
+                        out |= m_blocks[succ].live_in[w];
+                    }
+                    const uint64_t in = block.use[w] | (out & ~block.def[w]);
+                    if (out != block.live_out[w] || in != block.live_in[w]) {
+                        block.live_out[w] = out;
+                        block.live_in[w] = in;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+    void extend(const size_t vreg, const size_t pos){
+        Interval& interval = m_intervals[vreg];
+        interval.start = std::min(interval.start, pos);
+        interval.end = std::max(interval.end, pos);
+    }
+
+    void extend_set(const std::vector<uint64_t>& live, const size_t pos){
+        for (size_t w = 0; w < live.size(); w++) {
+            for (uint64_t bits = live[w]; bits != 0; bits &= bits - 1) {
+                extend(w * 64 + std::countr_zero(bits), pos);
+            }
+        }
+    }
+
+    // How many loops each instruction sits in. The Generator lays a loop out contiguously from its
+    // header to the block that jumps back to it, so every backward jump spans one loop.
+    [[nodiscard]] std::vector<uint32_t> loop_depths() const{
+        std::vector<uint32_t> depth(m_instrs.size());
+        for (size_t b = 0; b < m_blocks.size(); b++) {
+            for (const size_t succ : m_blocks[b].succs) {
+                if (succ > b) continue;
+                for (size_t i = m_blocks[succ].start; i < m_blocks[b].end; i++) {
+                    depth[i]++;
+                }
+            }
+        }
+        return depth;
+    }
+
+    void build_intervals(){
+        // A use inside a loop counts for as many as it runs, roughly, so the spill choice keeps loop
+        // variables in registers
+        const std::vector<uint32_t> depths = loop_depths();
+        for (const Block& block : m_blocks) {
+            extend_set(block.live_in, 2 * block.start);
+            if (block.end > block.start) {
+                extend_set(block.live_out, 2 * block.end - 1);
+            }
+        }
+        for (size_t i = 0; i < m_instrs.size(); i++) {
+            const Instr& instr = m_instrs[i];
+            const size_t weight = size_t{1} << (3 * std::min<uint32_t>(depths[i], 6));
+            if (instr.src.kind == Operand::Kind::vreg) {
+                extend(instr.src.imm, 2 * i);
+                m_intervals[instr.src.imm].uses += weight;
+            }
+            if (instr.dst.kind == Operand::Kind::vreg) {
+                if (reads_dst(instr.op)) {
+                    extend(instr.dst.imm, 2 * i);
+                }
+                if (writes_dst(instr.op)) {
+                    extend(instr.dst.imm, 2 * i + 1);
+                }
+                m_intervals[instr.dst.imm].uses += weight;
+            }
+        }
+    }
+
+    void spill(Interval& interval){
+        interval.reg.reset();
+        interval.slot = m_spill_slots++;
+    }
+
+    void linear_scan(){
+        std::vector<size_t> order;
+        for (size_t v = 0; v < m_vreg_count; v++) {
+            if (m_intervals[v].uses > 0) {
+                order.push_back(v);
+            }
+        }
+        std::ranges::sort(order, [&](const size_t a, const size_t b){
+            return m_intervals[a].start < m_intervals[b].start;
+        });
+
+        std::vector<Reg> free(std::rbegin(pool), std::rend(pool));
+        std::vector<size_t> active;
+        for (const size_t v : order) {
+            Interval& current = m_intervals[v];
+            std::erase_if(active, [&](const size_t a){
+                if (m_intervals[a].end < current.start) {
+                    free.push_back(m_intervals[a].reg.value());
+                    return true;
+                }
+                return false;
+            });
+
+            if (!free.empty()) {
+                current.reg = free.back();
+                free.pop_back();
+                active.push_back(v);
+                continue;
+            }
+
+            // Out of registers: spill whichever interval is used least, preferring the one that lives longest
+            const auto victim = std::ranges::min_element(active, [&](const size_t a, const size_t b){
+                const Interval& ia = m_intervals[a];
+                const Interval& ib = m_intervals[b];
+                return ia.uses != ib.uses ? ia.uses < ib.uses : ia.end > ib.end;
+            });
+            Interval& other = m_intervals[*victim];
+            if (other.uses < current.uses || (other.uses == current.uses && other.end > current.end)) {
+                current.reg = other.reg;
+                spill(other);
+                *victim = v;
+            }
+            else {
+                spill(current);
+            }
+        }
+    }
+
+    [[nodiscard]] Operand location(const Operand& operand) const{
+        if (operand.kind != Operand::Kind::vreg) {
+            return operand;
+        }
+        const Interval& interval = m_intervals[operand.imm];
+        if (interval.reg.has_value()) {
+            return op_reg(interval.reg.value());
+        }
+        return op_mem(Reg::rsp, static_cast<int64_t>(interval.slot * 8));
+    }
+
+    [[nodiscard]] std::vector<Instr> rewrite() const{
+        std::vector<Instr> out;
+        out.reserve(m_instrs.size() + 1);
+        if (m_spill_slots > 0) {
+            out.push_back({.op = Op::sub, .dst = op_reg(Reg::rsp), .src = op_imm(static_cast<int64_t>(m_spill_slots * 8))});
+        }
+
+        for (const Instr& instr : m_instrs) {
+            Instr phys = instr;
+            phys.dst = location(instr.dst);
+            phys.src = location(instr.src);
+
+            if (phys.op == Op::mov && phys.dst == phys.src) {
+                continue;
+            }
+            const bool mem_mem = phys.dst.kind == Operand::Kind::mem && phys.src.kind == Operand::Kind::mem;
+            const bool mem_imm64 = phys.dst.kind == Operand::Kind::mem && phys.src.kind == Operand::Kind::imm
+                && (phys.src.imm < INT32_MIN || phys.src.imm > INT32_MAX);
+            if (mem_mem || mem_imm64) {
+                out.push_back({.op = Op::mov, .dst = op_reg(Reg::rax), .src = phys.src});
+                phys.src = op_reg(Reg::rax);
+            }
+            out.push_back(phys);
+        }
+        return out;
+    }
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "error.h"
+#include "interner.h"
+
+// Binds every identifier read and every let/assignment to a variable slot, so later passes index by
+// slot instead of looking symbols up. Slots are numbered in declaration order, which means every slot
+// declared before a statement has a lower number than any slot declared inside it.
+class Resolver{
+public:
+    Resolver(Ast& ast, const Interner& interner)
+        : m_ast(ast),
+          m_interner(interner),
+          m_symbol_slots(interner.size(), no_slot)
+    {}
+
+    void run(){
+        m_ast.ident_slots.resize(m_ast.idents.size());
+        m_ast.store_slots.resize(m_ast.stores.size());
+        resolve_stmts(m_ast.root);
+        m_ast.slot_count = m_slot_count;
+    }
+
+private:
+    static constexpr uint32_t no_slot = UINT32_MAX;
+
+    Ast& m_ast;
+    const Interner& m_interner;
+    uint32_t m_slot_count = 0;
+    // The slot each symbol is bound to while in scope. Names can't be shadowed, so leaving a scope
+    // just unbinds what it declared.
+    std::vector<uint32_t> m_symbol_slots;
+    std::vector<SymbolId> m_declared{};
+    ExprWalker m_walker{};
+
+    uint32_t lookup(const Ident& ident) const{
+        const uint32_t slot = m_symbol_slots[ident.symbol];
+        if (slot == no_slot) {
+            compile_error("Undeclared identifier: " + std::string(m_interner.name(ident.symbol)));
+        }
+        return slot;
+    }
+
+    void resolve_expr(const ExprId expr){
+        for (const ExprId node : m_walker.postorder(m_ast, expr)) {
+            if (m_ast.kind(node) == ExprKind::ident) {
+                m_ast.ident_slots[m_ast.ident_index(node)] = lookup(m_ast.ident(node));
+            }
+        }
+    }
+
+    void resolve_scope(const BodyId body){
+        const size_t mark = m_declared.size();
+        resolve_stmts(body);
+        for (size_t i = mark; i < m_declared.size(); i++) {
+            m_symbol_slots[m_declared[i]] = no_slot;
+        }
+        m_declared.resize(mark);
+    }
+
+    void resolve_stmts(const BodyId body){
+        for (const StmtId stmt : m_ast.stmts(body)) {
+            switch (m_ast.kind(stmt)) {
+            case StmtKind::exit:
+                resolve_expr(m_ast.exit_expr(stmt));
+                break;
+            case StmtKind::let: {
+                const Store& store = m_ast.store(stmt);
+                if (m_symbol_slots[store.ident.symbol] != no_slot) {
+                    compile_error("Identifier already used: " + std::string(m_interner.name(store.ident.symbol)));
+                }
+                resolve_expr(store.expr);
+                m_symbol_slots[store.ident.symbol] = m_slot_count;
+                m_declared.push_back(store.ident.symbol);
+                m_ast.store_slots[m_ast.store_index(stmt)] = m_slot_count++;
+                break;
+            }
+            case StmtKind::assign: {
+                const Store& store = m_ast.store(stmt);
+                m_ast.store_slots[m_ast.store_index(stmt)] = lookup(store.ident);
+                resolve_expr(store.expr);
+                break;
+            }
+            case StmtKind::scope:
+                resolve_scope(m_ast.scope_body(stmt));
+                break;
+            case StmtKind::if_:
+                for (const Arm& arm : m_ast.if_arms(stmt)) {
+                    if (arm.cond != no_expr) {
+                        resolve_expr(arm.cond);
+                    }
+                    resolve_scope(arm.body);
+                }
+                break;
+            case StmtKind::while_:
+                resolve_expr(m_ast.while_stmt(stmt).cond);
+                resolve_scope(m_ast.while_stmt(stmt).body);
+                break;
+            }
+        }
+    }
+};
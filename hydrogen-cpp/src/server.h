@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cli.h"
+#include "incremental.h"
+#include "protocol.h"
+#include "source.h"
+#include "thread_pool.h"
+
+// Long-running compile daemon: `hydro --serve` listens on a Unix socket and runs each request's
+// command line exactly as hydro would, sending back the exit status and diagnostics. Each connection
+// is served on its own thread, which only moves bytes: every compile, a single file as well as each
+// file of a batch and the chunks of a large file being lexed in parallel, runs on the daemon's one
+// worker pool (a request's -j is ignored). Each worker keeps its interner, with its table and arena,
+// from one file to the next, so once the daemon has warmed up a request only pays for the compile
+// itself. A --run request is the exception, see below.
+//
+// Whoever can connect can run code as the daemon's user, so the socket is only accessible to that
+// user, and connections from any other uid are refused. A --run request runs in a child process with a
+// time limit, so a program that never exits can't keep a thread of the daemon busy forever.
+//
+// An editor can also keep a file open in the daemon and send it each edit to the buffer, getting back
+// the parse error of the edited text, if any. Only the statements an edit touches are parsed again
+// (see IncrementalParser), so the answer comes as fast for a large file as for a small one.
+//   --open <file>                            parses the file as it is on disk
+//   --edit <file> <offset> <removed> <text>  replaces `removed` bytes at `offset` with `text`
+//   --close <file>                           forgets the file
+class CompileServer{
+public:
+    static constexpr unsigned run_time_limit_seconds = 10;
+
+    explicit CompileServer(std::string socket_path)
+        : m_socket_path(std::move(socket_path)),
+          m_pool(std::thread::hardware_concurrency())
+    {}
+
+    CompileServer(const CompileServer&) = delete;
+
+    CompileServer& operator=(const CompileServer&) = delete;
+
+    ~CompileServer(){
+        if (m_fd >= 0) {
+            ::close(m_fd);
+            ::unlink(m_socket_path.c_str());
+        }
+    }
+
+    // Only returns if the socket can't be set up
+    int run(){
+        const std::optional<sockaddr_un> addr = protocol::socket_address(m_socket_path);
+        if (!addr.has_value()) {
+            std::cerr << "[Server Error] Socket path too long: " << m_socket_path << std::endl;
+            return EXIT_FAILURE;
+        }
+        m_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (m_fd < 0) {
+            return error("Could not create socket");
+        }
+        // A socket file left behind by a daemon that didn't shut down cleanly would block bind()
+        ::unlink(m_socket_path.c_str());
+        // Created with mode 0600 from the start, so there is no moment anyone else could connect
+        const mode_t old_mask = ::umask(0177);
+        const int bound = ::bind(m_fd, reinterpret_cast<const sockaddr*>(&addr.value()), sizeof(sockaddr_un));
+        ::umask(old_mask);
+        if (bound < 0) {
+            return error("Could not bind");
+        }
+        if (::listen(m_fd, SOMAXCONN) < 0) {
+            return error("Could not listen on");
+        }
+        std::signal(SIGPIPE, SIG_IGN);
+        std::cerr << "Listening on " << m_socket_path << std::endl;
+
+        while (true) {
+            const int client = ::accept4(m_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                return error("Could not accept on");
+            }
+            if (!same_user(client)) {
+                ::close(client);
+                continue;
+            }
+            std::thread([this, client]{
+                serve(client);
+                ::close(client);
+            }).detach();
+        }
+    }
+
+private:
+    int error(const char* msg) const{
+        std::cerr << "[Server Error] " << msg << " " << m_socket_path << ": " << std::strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    static bool same_user(const int client){
+        ucred peer{};
+        socklen_t size = sizeof(peer);
+        if (::getsockopt(client, SOL_SOCKET, SO_PEERCRED, &peer, &size) != 0) {
+            std::cerr << "[Server Error] Could not identify a client: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        if (peer.uid != ::geteuid()) {
+            std::cerr << "[Server Error] Refused a connection from uid " << peer.uid << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // A client that hangs up or sends garbage only loses its own request
+    void serve(const int client){
+        const std::optional<std::string> payload = protocol::read_frame(client);
+        if (!payload.has_value()) {
+            return;
+        }
+        const std::optional<protocol::Request> request = protocol::decode_request(payload.value());
+        if (!request.has_value()) {
+            return;
+        }
+        if (is_document_command(request->args)) {
+            std::ostringstream output;
+            const int status = serve_document(request->args, request->cwd, output);
+            protocol::write_frame(client, protocol::encode_response(status, output.str()));
+            return;
+        }
+        const bool runs = std::ranges::any_of(request->args, [](const std::string& arg){
+            return arg == "--run" || arg == "--run=vm";
+        });
+        if (runs) {
+            serve_run(client, request.value());
+            return;
+        }
+        std::ostringstream output;
+        const int status = cli::run(request->args, request->cwd, output, &m_pool);
+        protocol::write_frame(client, protocol::encode_response(status, output.str()));
+    }
+
+    // The child answers the client itself. If it doesn't exit normally, whatever stopped it (most
+    // likely the alarm) is reported instead. A run never uses the pool, whose threads the child
+    // doesn't have, so it is compiled cold, on the child's own thread.
+    static void serve_run(const int client, const protocol::Request& request){
+        const pid_t pid = ::fork();
+        if (pid < 0) {
+            protocol::write_frame(client, protocol::encode_response(EXIT_FAILURE, "[Server Error] Could not fork\n"));
+            return;
+        }
+        if (pid == 0) {
+            ::alarm(run_time_limit_seconds);
+            std::ostringstream output;
+            const int status = cli::run(request.args, request.cwd, output);
+            protocol::write_frame(client, protocol::encode_response(status, output.str()));
+            ::_exit(EXIT_SUCCESS);
+        }
+        int status = 0;
+        while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        if (WIFEXITED(status)) {
+            return;
+        }
+        const int signal = WIFSIGNALED(status) ? WTERMSIG(status) : SIGKILL;
+        const std::string message = signal == SIGALRM
+            ? "[Runtime Error] Stopped after " + std::to_string(run_time_limit_seconds) + " s\n"
+            : "[Server Error] The run was stopped by " + std::string(strsignal(signal)) + "\n";
+        protocol::write_frame(client, protocol::encode_response(128 + signal, message));
+    }
+
+    static bool is_document_command(const std::vector<std::string>& args){
+        return !args.empty() && (args[0] == "--open" || args[0] == "--edit" || args[0] == "--close");
+    }
+
+    static std::optional<size_t> parse_size(const std::string& arg){
+        size_t value = 0;
+        const auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+        if (ec != std::errc{} || end != arg.data() + arg.size()) {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    // Documents are keyed by absolute path, so clients in different directories share them. Exits with
+    // failure, printing the error, when the text doesn't parse.
+    int serve_document(const std::vector<std::string>& args, const std::string& cwd, std::ostream& err){
+        if (args.size() != (args[0] == "--edit" ? 5 : 2)) {
+            cli::usage(err);
+            return EXIT_FAILURE;
+        }
+        const std::string path = (std::filesystem::path(cwd) / args[1]).lexically_normal();
+        const std::lock_guard lock(m_documents_mutex);
+        try {
+            if (args[0] == "--open") {
+                // Opened empty and then filled by an edit, so a file that doesn't parse is kept too
+                const std::string text(SourceFile(path).text());
+                m_documents.erase(path);
+                IncrementalParser& document = m_documents.try_emplace(path, std::string()).first->second;
+                document.apply({.offset = 0, .removed = 0, .inserted = text});
+                return EXIT_SUCCESS;
+            }
+            const auto document = m_documents.find(path);
+            if (document == m_documents.end()) {
+                err << "[Server Error] Not open: " << path << std::endl;
+                return EXIT_FAILURE;
+            }
+            if (args[0] == "--close") {
+                m_documents.erase(document);
+                return EXIT_SUCCESS;
+            }
+            const std::optional<size_t> offset = parse_size(args[2]);
+            const std::optional<size_t> removed = parse_size(args[3]);
+            if (!offset.has_value() || !removed.has_value()) {
+                cli::usage(err);
+                return EXIT_FAILURE;
+            }
+            document->second.apply({.offset = offset.value(), .removed = removed.value(), .inserted = args[4]});
+            return EXIT_SUCCESS;
+        }
+        catch (const CompileError& e) {
+            err << e.what() << std::endl;
+        }
+        catch (const std::out_of_range& e) {
+            err << "[Server Error] " << e.what() << ": " << path << std::endl;
+        }
+        return EXIT_FAILURE;
+    }
+
+    std::string m_socket_path;
+    ThreadPool m_pool;
+    int m_fd = -1;
+    std::mutex m_documents_mutex{};
+    std::unordered_map<std::string, IncrementalParser> m_documents{};
+};
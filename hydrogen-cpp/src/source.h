@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+
+// Read-only view of a source file. Regular files are mapped straight into memory so tokens can point
+// into the mapping without copying; stdin ("-"), pipes and anything else that can't be mapped are read
+// into an owned buffer instead.
+class SourceFile{
+public:
+    explicit SourceFile(const std::string& path){
+        const int fd = path == "-" ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error("Could not open " + path);
+        }
+
+        struct stat st{};
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* mapping = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                ::madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+                m_mapping = mapping;
+                m_text = {static_cast<const char*>(mapping), static_cast<size_t>(st.st_size)};
+            }
+        }
+        const bool read_ok = m_mapping != nullptr || read_all(fd);
+        const int read_errno = errno;
+        if (fd != STDIN_FILENO) {
+            ::close(fd);
+        }
+        if (!read_ok) {
+            errno = read_errno;
+            error("Could not read " + path);
+        }
+        if (m_mapping == nullptr) {
+            m_text = m_buffer;
+        }
+    }
+
+    SourceFile(const SourceFile&) = delete;
+
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    ~SourceFile(){
+        if (m_mapping != nullptr) {
+            ::munmap(m_mapping, m_text.size());
+        }
+    }
+
+    [[nodiscard]] std::string_view text() const{
+        return m_text;
+    }
+
+private:
+    [[noreturn]] static void error(const std::string& msg){
+        compile_error("[Source Error] " + msg + ": " + std::strerror(errno));
+    }
+
+    // Returns false (with errno set) if reading fails
+    bool read_all(const int fd){
+        constexpr size_t chunk = 64 * 1024;
+        size_t size = 0;
+        while (true) {
+            m_buffer.resize(size + chunk);
+            const ssize_t n = ::read(fd, m_buffer.data() + size, chunk);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            if (n == 0) break;
+            size += static_cast<size_t>(n);
+        }
+        m_buffer.resize(size);
+        return true;
+    }
+
+    void* m_mapping = nullptr;
+    std::string m_buffer{};
+    std::string_view m_text{};
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "arena.h"
+#include "ast.h"
+
+// What one compile_file() call spent its time and memory on, filled in when --stats asks for it
+struct CompileStats{
+    struct Phase{
+        std::string_view name;
+        double wall_ms;
+        double cpu_ms;
+    };
+
+    std::vector<Phase> phases{};
+    size_t source_bytes = 0;
+    size_t tokens = 0;
+    std::array<size_t, expr_kind_count> exprs{}; // AST nodes by kind, as parsed
+    std::array<size_t, stmt_kind_count> stmts{};
+    size_t symbols = 0;
+    ArenaAllocator::Stats arena{}; // the interner's arena
+    size_t ir_insts = 0;           // after IR optimization, counting phis and terminators
+    size_t instrs = 0;             // machine instructions after register allocation, or bytecode ones
+    size_t frame_bytes = 0;        // stack reserved for spills, the program's only stack use
+    size_t code_bytes = 0;
+
+    void count_nodes(const Ast& ast){
+        for (const ExprKind kind : ast.expr_kinds) {
+            exprs[static_cast<size_t>(kind)]++;
+        }
+        for (const StmtKind kind : ast.stmt_kinds) {
+            stmts[static_cast<size_t>(kind)]++;
+        }
+    }
+};
+
+// Splits a run into consecutive phases: each lap() records the time since the previous lap under the
+// given name. CPU time is the calling thread's, so batch workers don't count each other's work.
+// Without stats to fill in it does nothing, not even read the clocks.
+class PhaseTimer{
+public:
+    explicit PhaseTimer(CompileStats* stats)
+        : m_stats(stats)
+    {
+        if (m_stats != nullptr) {
+            m_wall = std::chrono::steady_clock::now();
+            m_cpu = thread_cpu_ms();
+        }
+    }
+
+    void lap(const std::string_view name){
+        if (m_stats == nullptr) {
+            return;
+        }
+        const auto wall = std::chrono::steady_clock::now();
+        const double cpu = thread_cpu_ms();
+        m_stats->phases.push_back({
+            .name = name,
+            .wall_ms = std::chrono::duration<double, std::milli>(wall - m_wall).count(),
+            .cpu_ms = cpu - m_cpu,
+        });
+        m_wall = wall;
+        m_cpu = cpu;
+    }
+
+private:
+    CompileStats* m_stats;
+    std::chrono::steady_clock::time_point m_wall{};
+    double m_cpu = 0;
+
+    static double thread_cpu_ms(){
+        timespec ts{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<double>(ts.tv_sec) * 1e3 + static_cast<double>(ts.tv_nsec) / 1e6;
+    }
+};
+
+inline void write_stats(std::ostream& out, const std::string_view input, const CompileStats& stats){
+    double wall_total = 0;
+    double cpu_total = 0;
+    char line[96];
+    out << "Stats for " << input << ":" << std::endl;
+    out << "  phase         wall ms     cpu ms" << std::endl;
+    for (const CompileStats::Phase& phase : stats.phases) {
+        std::snprintf(line, sizeof(line), "  %-10.*s %10.3f %10.3f", static_cast<int>(phase.name.size()),
+                      phase.name.data(), phase.wall_ms, phase.cpu_ms);
+        out << line << std::endl;
+        wall_total += phase.wall_ms;
+        cpu_total += phase.cpu_ms;
+    }
+    std::snprintf(line, sizeof(line), "  %-10s %10.3f %10.3f", "total", wall_total, cpu_total);
+    out << line << std::endl;
+
+    out << "  source bytes: " << stats.source_bytes << ", tokens: " << stats.tokens << std::endl;
+    out << "  statements:";
+    for (size_t kind = 0; kind < stmt_kind_count; kind++) {
+        out << (kind == 0 ? " " : ", ") << to_string(static_cast<StmtKind>(kind)) << " " << stats.stmts[kind];
+    }
+    out << std::endl << "  expressions:";
+    for (size_t kind = 0; kind < expr_kind_count; kind++) {
+        out << (kind == 0 ? " " : ", ") << to_string(static_cast<ExprKind>(kind)) << " " << stats.exprs[kind];
+    }
+    out << std::endl;
+    out << "  symbols: " << stats.symbols << ", arena bytes: " << stats.arena.used << " used, "
+        << stats.arena.wasted << " wasted, " << stats.arena.reserved << " reserved in "
+        << stats.arena.blocks << " blocks" << std::endl;
+    out << "  ir instructions: " << stats.ir_insts << ", emitted instructions: " << stats.instrs
+        << ", stack frame bytes: " << stats.frame_bytes << ", code bytes: " << stats.code_bytes << std::endl;
+}
+
+inline void write_json_string(std::ostream& out, const std::string_view text){
+    out << '"';
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out << escaped;
+        }
+        else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+// One JSON object on one line, so a batch's stats can be read as JSON Lines
+inline void write_stats_json(std::ostream& out, const std::string_view input, const CompileStats& stats){
+    out << "{\"input\": ";
+    write_json_string(out, input);
+    out << ", \"phases\": [";
+    for (size_t i = 0; i < stats.phases.size(); i++) {
+        const CompileStats::Phase& phase = stats.phases[i];
+        out << (i == 0 ? "" : ", ") << "{\"name\": \"" << phase.name << "\", \"wall_ms\": " << phase.wall_ms
+            << ", \"cpu_ms\": " << phase.cpu_ms << "}";
+    }
+    out << "], \"source_bytes\": " << stats.source_bytes << ", \"tokens\": " << stats.tokens;
+    out << ", \"stmts\": {";
+    for (size_t kind = 0; kind < stmt_kind_count; kind++) {
+        out << (kind == 0 ? "" : ", ") << '"' << to_string(static_cast<StmtKind>(kind)) << "\": " << stats.stmts[kind];
+    }
+    out << "}, \"exprs\": {";
+    for (size_t kind = 0; kind < expr_kind_count; kind++) {
+        out << (kind == 0 ? "" : ", ") << '"' << to_string(static_cast<ExprKind>(kind)) << "\": " << stats.exprs[kind];
+    }
+    out << "}, \"symbols\": " << stats.symbols << ", \"arena\": {\"used\": " << stats.arena.used
+        << ", \"wasted\": " << stats.arena.wasted << ", \"reserved\": " << stats.arena.reserved
+        << ", \"blocks\": " << stats.arena.blocks << "}, \"ir_insts\": " << stats.ir_insts
+        << ", \"instrs\": " << stats.instrs << ", \"frame_bytes\": " << stats.frame_bytes
+        << ", \"code_bytes\": " << stats.code_bytes << "}" << std::endl;
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own task deque. A worker pops its own newest task from
+// the back and, when it runs dry, steals the oldest task from the front of another worker's deque, so
+// a few long jobs don't leave the other cores idle behind them. Tasks submitted from outside the pool
+// are dealt round-robin; tasks submitted from a worker go onto that worker's own deque.
+class ThreadPool{
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(const size_t threads)
+    {
+        const size_t count = threads == 0 ? 1 : threads;
+        for (size_t i = 0; i < count; i++) {
+            m_queues.push_back(std::make_unique<Queue>());
+        }
+        for (size_t i = 0; i < count; i++) {
+            m_workers.emplace_back([this, i]{ work(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool(){
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+        m_work_cv.notify_all();
+        for (std::thread& worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    [[nodiscard]] size_t size() const{
+        return m_workers.size();
+    }
+
+    // Tasks must not throw; catch inside the task and record the failure instead
+    void submit(Task task){
+        const size_t index = t_pool == this ? t_worker : m_next_queue++ % m_queues.size();
+        {
+            std::lock_guard lock(m_queues[index]->mutex);
+            m_queues[index]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard lock(m_mutex);
+            m_queued++;
+            m_unfinished++;
+        }
+        m_work_cv.notify_one();
+    }
+
+    // Blocks until every submitted task has finished
+    void wait(){
+        std::unique_lock lock(m_mutex);
+        m_done_cv.wait(lock, [this]{ return m_unfinished == 0; });
+    }
+
+    // Runs task(0) to task(count - 1) and returns once all of them have finished. Any number of threads
+    // may call this at once, the pool's own workers included: a worker that starts a batch from inside
+    // a task runs the batch's tasks too, and never anything else, so it can't deadlock waiting for
+    // workers that are all busy, nor start an unrelated task in the middle of its own.
+    void run_batch(const size_t count, const std::function<void(size_t)>& task){
+        if (count == 0) {
+            return;
+        }
+        // Shared with the runners, which may only be dequeued after the batch has returned, find
+        // nothing left to claim and exit
+        const auto batch = std::make_shared<Batch>();
+        const auto run = [this, batch, count, &task]{
+            for (size_t i = batch->next++; i < count; i = batch->next++) {
+                task(i);
+                std::lock_guard lock(m_mutex);
+                if (++batch->finished == count) {
+                    m_done_cv.notify_all();
+                }
+            }
+        };
+
+        const bool inside = t_pool == this;
+        for (size_t i = inside ? 1 : 0; i < std::min(count, size()); i++) {
+            submit(run);
+        }
+        if (inside) {
+            run();
+        }
+        std::unique_lock lock(m_mutex);
+        m_done_cv.wait(lock, [&batch, count]{ return batch->finished == count; });
+    }
+
+private:
+    struct Queue{
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // Tasks of a run_batch() call are claimed by index; `finished` is guarded by m_mutex
+    struct Batch{
+        std::atomic<size_t> next = 0;
+        size_t finished = 0;
+    };
+
+    static inline thread_local const ThreadPool* t_pool = nullptr;
+    static inline thread_local size_t t_worker = 0;
+
+    void work(const size_t index){
+        t_pool = this;
+        t_worker = index;
+        while (true) {
+            {
+                std::unique_lock lock(m_mutex);
+                m_work_cv.wait(lock, [this]{ return m_stopping || m_queued > 0; });
+                if (m_queued == 0) {
+                    return;
+                }
+                // Claim a task before looking for it, so idle workers don't all race for the same one
+                m_queued--;
+            }
+
+            Task task = take(index);
+            task();
+
+            std::lock_guard lock(m_mutex);
+            if (--m_unfinished == 0) {
+                m_done_cv.notify_all();
+            }
+        }
+    }
+
+    // Tasks are pushed before they are counted, so a claimed task is always sitting in some queue;
+    // a scan can still miss it while other workers are moving through the queues, hence the retry
+    Task take(const size_t index){
+        while (true) {
+            if (std::optional<Task> task = pop_back(*m_queues[index])) {
+                return std::move(*task);
+            }
+            for (size_t i = 1; i < m_queues.size(); i++) {
+                if (std::optional<Task> task = pop_front(*m_queues[(index + i) % m_queues.size()])) {
+                    return std::move(*task);
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    static std::optional<Task> pop_back(Queue& queue){
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            return std::nullopt;
+        }
+        Task task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return task;
+    }
+
+    static std::optional<Task> pop_front(Queue& queue){
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            return std::nullopt;
+        }
+        Task task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        return task;
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues{};
+    std::vector<std::thread> m_workers{};
+    std::atomic<size_t> m_next_queue = 0;
+
+    std::mutex m_mutex{};
+    std::condition_variable m_work_cv{};
+    std::condition_variable m_done_cv{};
+    size_t m_queued = 0;
+    size_t m_unfinished = 0;
+    bool m_stopping = false;
+};
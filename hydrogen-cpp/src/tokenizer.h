@@ -1,9 +1,25 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <string_view>
 #include <utility>
 #include<vector>
 #include<string>
 
+#include "error.h"
+#include "interner.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 enum class TokenType{
     exit,
     int_literal,
@@ -21,7 +37,8 @@ enum class TokenType{
     close_curly,
     if_,
     elif,
-    else_
+    else_,
+    while_
 };
 
 inline std::string to_string(const TokenType type){
@@ -60,9 +77,12 @@ inline std::string to_string(const TokenType type){
         return "`elif`";
     case TokenType::else_:
         return "`else`";
+    case TokenType::while_:
+        return "`while`";
     }
 
     assert(false);
+    __builtin_unreachable();
 }
 
 inline std::optional<int> bin_prec(TokenType const type){
@@ -81,146 +101,267 @@ inline std::optional<int> bin_prec(TokenType const type){
 struct Token{
     TokenType type;
     int line;
-    std::optional<std::string> value;
+    std::optional<std::string_view> value{};
+    SymbolId symbol = 0; // identifiers only
+    // Byte range in the source
+    uint32_t begin = 0;
+    uint32_t end = 0;
+};
+
+// Integer literals are validated while tokenizing, so this cannot fail
+inline uint64_t int_lit_value(const Token& token){
+    uint64_t value = 0;
+    const std::string_view text = token.value.value();
+    std::from_chars(text.data(), text.data() + text.size(), value);
+    return value;
+}
+
+enum class CharClass : uint8_t{
+    invalid,
+    space,
+    alpha,
+    digit,
+    slash,
+    punct
+};
+
+inline constexpr std::array<CharClass, 256> char_classes = []{
+    std::array<CharClass, 256> classes{};
+    for (int c = 'a'; c <= 'z'; c++) classes[c] = CharClass::alpha;
+    for (int c = 'A'; c <= 'Z'; c++) classes[c] = CharClass::alpha;
+    for (int c = '0'; c <= '9'; c++) classes[c] = CharClass::digit;
+    for (const char c : {' ', '\t', '\n', '\v', '\f', '\r'}) classes[c] = CharClass::space;
+    for (const char c : {'(', ')', ';', '=', '+', '*', '-', '{', '}'}) classes[c] = CharClass::punct;
+    classes['/'] = CharClass::slash;
+    return classes;
+}();
+
+inline constexpr std::array<TokenType, 256> punct_types = []{
+    std::array<TokenType, 256> types{};
+    types['('] = TokenType::open_paren;
+    types[')'] = TokenType::close_paren;
+    types[';'] = TokenType::semicolon;
+    types['='] = TokenType::eq;
+    types['+'] = TokenType::plus;
+    types['*'] = TokenType::star;
+    types['-'] = TokenType::minus;
+    types['{'] = TokenType::open_curly;
+    types['}'] = TokenType::close_curly;
+    return types;
+}();
+
+struct Keyword{
+    std::string_view text;
+    TokenType type;
+};
+
+// Perfect hash over the keyword set, checked for collisions at compile time
+constexpr size_t keyword_hash(const std::string_view word){
+    return (word.size() * 4 + static_cast<unsigned char>(word.front()) + static_cast<unsigned char>(word.back())) & 7;
+}
+
+inline constexpr std::array<Keyword, 6> keywords = {{
+    {"exit", TokenType::exit},
+    {"let", TokenType::let},
+    {"if", TokenType::if_},
+    {"elif", TokenType::elif},
+    {"else", TokenType::else_},
+    {"while", TokenType::while_},
+}};
+
+inline constexpr std::array<std::optional<Keyword>, 8> keyword_table = []{
+    std::array<std::optional<Keyword>, 8> table{};
+    for (const Keyword& keyword : keywords) {
+        if (table[keyword_hash(keyword.text)].has_value()) throw "keyword hash collision";
+        table[keyword_hash(keyword.text)] = keyword;
+    }
+    return table;
+}();
+
+// Tokens lexed ahead of parsing. If lexing stopped at an error, the error is kept after the tokens
+// that came before it, to be thrown only once the parser has read that far, just as if it were
+// pulling tokens from a Tokenizer.
+struct TokenStream{
+    std::vector<Token> tokens{};
+    std::exception_ptr error{};
 };
 
+// Produces tokens on demand; the parser pulls them through a small lookahead window, so the token
+// stream never has to exist all at once
 class Tokenizer{
 public:
-    explicit Tokenizer(std::string src): m_src(std::move(src)){}
-
-    std::vector<Token> tokenize(){
-        std::vector<Token> tokens;
-        std::string buf;
-        // TODO: line count not working
-        int line_count = 1;
-
-        while (peek().has_value()) {
-            if (std::isalpha(peek().value())) {
-                buf.push_back(consume());
-                while (peek().has_value() && std::isalnum(peek().value())) {
-                    buf.push_back(consume());
-                }
-                if (buf == "exit") {
-                    tokens.push_back({TokenType::exit, line_count});
-                    buf.clear();
-                }
-                else if (buf == "let") {
-                    tokens.push_back({TokenType::let, line_count});
-                    buf.clear();
-                }
-                else if (buf == "if") {
-                    tokens.push_back({TokenType::if_, line_count});
-                    buf.clear();
-                }
-                else if (buf == "elif") {
-                    tokens.push_back({TokenType::elif, line_count});
-                    buf.clear();
+    // Lexing can start at any offset that lies between tokens, given the line it is on
+    Tokenizer(const std::string_view src, Interner& interner, const size_t offset = 0, const int line = 1)
+        : m_src(src.data()),
+          m_pos(src.data() + offset),
+          m_end(src.data() + src.size()),
+          m_interner(interner),
+          m_line(line)
+    {}
+
+    std::optional<Token> next(){
+        const char* p = m_pos;
+        const char* const end = m_end;
+        std::optional<Token> token;
+        const char* token_begin = p;
+
+        while (p < end && !token.has_value()) {
+            token_begin = p;
+            const auto c = static_cast<unsigned char>(*p);
+            switch (char_classes[c]) {
+            case CharClass::space:
+                p = skip_space(p, end, m_line);
+                break;
+            case CharClass::alpha: {
+                const char* start = p++;
+                while (p < end && is_alnum(*p)) {
+                    p++;
                 }
-                else if (buf == "else") {
-                    tokens.push_back({TokenType::else_, line_count});
-                    buf.clear();
+                const std::string_view word(start, p - start);
+                if (const std::optional<TokenType> keyword = lookup_keyword(word)) {
+                    token = {.type = keyword.value(), .line = m_line};
                 }
                 else {
-                    tokens.push_back({TokenType::ident, line_count, buf});
-                    buf.clear();
+                    const SymbolId symbol = m_interner.intern(word);
+                    token = {
+                        .type = TokenType::ident, .line = m_line, .value = m_interner.name(symbol), .symbol = symbol
+                    };
                 }
+                break;
             }
-            else if (std::isdigit(peek().value())) {
-                buf.push_back(consume());
-                while (peek().has_value() && std::isdigit(peek().value())) {
-                    buf.push_back(consume());
+            case CharClass::digit: {
+                const char* start = p++;
+                while (p < end && char_classes[static_cast<unsigned char>(*p)] == CharClass::digit) {
+                    p++;
                 }
-                tokens.push_back({TokenType::int_literal, line_count, buf});
-                buf.clear();
-            }
-            else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/') {
-                while (peek().has_value() && peek().value() != '\n') {
-                    consume();
+                uint64_t value;
+                if (std::from_chars(start, p, value).ec != std::errc()) {
+                    compile_error("Integer literal out of range on line " + std::to_string(m_line));
                 }
+                token = {.type = TokenType::int_literal, .line = m_line, .value = std::string_view(start, p - start)};
+                break;
             }
-            else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*') {
-                consume();
-                consume();
-                while (peek().has_value()) {
-                    if (peek().value() == '*' && peek(1).has_value() && peek(1).value() == '/') {
-                        break;
-                    }
-                    consume();
+            case CharClass::slash:
+                if (p + 1 < end && p[1] == '/') {
+                    p = find_byte(p + 2, end, '\n');
                 }
-                if (peek().has_value())
-                    consume();
-                if (peek().has_value())
-                    consume();
-            }
-            else if (peek().value() == '(') {
-                consume();
-                tokens.push_back({TokenType::open_paren, line_count});
-            }
-            else if (peek().value() == ')') {
-                consume();
-                tokens.push_back({TokenType::close_paren, line_count});
-            }
-            else if (peek().value() == ';') {
-                consume();
-                tokens.push_back({TokenType::semicolon, line_count});
-            }
-            else if (peek().value() == '=') {
-                consume();
-                tokens.push_back({TokenType::eq, line_count});
-            }
-            else if (peek().value() == '+') {
-                consume();
-                tokens.push_back({TokenType::plus, line_count});
-            }
-            else if (peek().value() == '*') {
-                consume();
-                tokens.push_back({TokenType::star, line_count});
-            }
-            else if (peek().value() == '-') {
-                consume();
-                tokens.push_back({TokenType::minus, line_count});
-            }
-            else if (peek().value() == '/') {
-                consume();
-                tokens.push_back({TokenType::fslash, line_count});
-            }
-            else if (peek().value() == '{') {
-                consume();
-                tokens.push_back({TokenType::open_curly, line_count});
-            }
-            else if (peek().value() == '}') {
-                consume();
-                tokens.push_back({TokenType::close_curly, line_count});
-            }
-            else if (peek().value() == '\n') {
-                consume();
-                line_count++;
-            }
-            else if (std::isspace(peek().value())) {
-                consume();
-            }
-            else {
-                std::cerr << "Invalid token" << std::endl;
-                exit(EXIT_FAILURE);
+                else if (p + 1 < end && p[1] == '*') {
+                    p = skip_block_comment(p + 2, end, m_line);
+                }
+                else {
+                    token = {.type = TokenType::fslash, .line = m_line};
+                    p++;
+                }
+                break;
+            case CharClass::punct:
+                token = {.type = punct_types[c], .line = m_line};
+                p++;
+                break;
+            case CharClass::invalid:
+                compile_error("Invalid token");
             }
         }
-        m_index = 0;
-        return tokens;
+
+        m_pos = p;
+        if (token.has_value()) {
+            token->begin = static_cast<uint32_t>(token_begin - m_src);
+            token->end = static_cast<uint32_t>(p - m_src);
+        }
+        return token;
+    }
+
+    // Appends every remaining token to `tokens`. If lexing fails, the tokens before the error are
+    // already there.
+    void tokenize(std::vector<Token>& tokens){
+        // Few sources have more than a token per two bytes. Growing past the guess would copy every
+        // token so far, while reserving too much only costs address space that is never touched.
+        tokens.reserve(tokens.size() + static_cast<size_t>(m_end - m_pos) / 2);
+        while (std::optional<Token> token = next()) {
+            tokens.push_back(token.value());
+        }
     }
 
 private:
-    const std::string m_src;
+    static std::optional<TokenType> lookup_keyword(const std::string_view word){
+        const std::optional<Keyword>& keyword = keyword_table[keyword_hash(word)];
+        if (keyword.has_value() && keyword->text == word) {
+            return keyword->type;
+        }
+        return {};
+    }
+
+    static bool is_alnum(const char c){
+        const CharClass char_class = char_classes[static_cast<unsigned char>(c)];
+        return char_class == CharClass::alpha || char_class == CharClass::digit;
+    }
 
-    int m_index = 0;
+    // Whitespace is skipped 16 bytes at a time, counting the newlines it passes over
+    static const char* skip_space(const char* p, const char* end, int& line_count){
+#ifdef __SSE2__
+        const __m128i newline = _mm_set1_epi8('\n');
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i below_tab = _mm_set1_epi8('\t' - 1);
+        const __m128i above_cr = _mm_set1_epi8('\r' + 1);
+        while (end - p >= 16) {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            const __m128i control = _mm_and_si128(_mm_cmpgt_epi8(chunk, below_tab), _mm_cmplt_epi8(chunk, above_cr));
+            const __m128i blank = _mm_or_si128(control, _mm_cmpeq_epi8(chunk, space));
+            const auto non_blank = static_cast<uint32_t>(~_mm_movemask_epi8(blank) & 0xFFFF);
+            auto newlines = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+            if (non_blank == 0) {
+                line_count += std::popcount(newlines);
+                p += 16;
+                continue;
+            }
+            const int skip = std::countr_zero(non_blank);
+            line_count += std::popcount(newlines & ((1u << skip) - 1));
+            return p + skip;
+        }
+#endif
+        while (p < end && char_classes[static_cast<unsigned char>(*p)] == CharClass::space) {
+            if (*p == '\n') {
+                line_count++;
+            }
+            p++;
+        }
+        return p;
+    }
 
-    [[nodiscard]] std::optional<char> peek(const int offset = 0) const{
-        if (m_index + offset >= m_src.size()) {
-            return {};
+    static const char* find_byte(const char* p, const char* end, const char byte){
+#ifdef __SSE2__
+        const __m128i needle = _mm_set1_epi8(byte);
+        while (end - p >= 16) {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            if (const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle))) {
+                return p + std::countr_zero(static_cast<uint32_t>(mask));
+            }
+            p += 16;
+        }
+#endif
+        while (p < end && *p != byte) {
+            p++;
         }
-        return m_src[m_index + offset];
+        return p;
     }
 
-    char consume(){
-        return m_src[m_index++];
+    // Skips to just past the closing `*/` (or to the end of input), counting newlines on the way
+    static const char* skip_block_comment(const char* p, const char* end, int& line_count){
+        while (true) {
+            const char* star = find_byte(p, end, '*');
+            line_count += static_cast<int>(std::count(p, star, '\n'));
+            if (star == end) {
+                return end;
+            }
+            if (star + 1 < end && star[1] == '/') {
+                return star + 2;
+            }
+            p = star + 1;
+        }
     }
+
+    const char* m_src;
+    const char* m_pos;
+    const char* m_end;
+    Interner& m_interner;
+    int m_line;
 };
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <csignal>
+#include <cstdint>
+#include <vector>
+
+#include "bytecode.h"
+
+// Interpreter for BytecodeProg. With GCC and Clang, every handler jumps straight to the next one
+// through a table of label addresses (computed goto), so each opcode gets its own indirect branch to
+// predict; elsewhere the same handlers sit in a switch. Arithmetic wraps and divides unsigned, like the
+// native code.
+class Vm{
+public:
+    struct Result{
+        int exit_code; // truncated to 8 bits as the kernel would
+        int signal;    // SIGFPE for a division by zero, which the native code would die of, else 0
+    };
+
+    explicit Vm(const BytecodeProg& prog)
+        : m_prog(prog)
+    {}
+
+    [[nodiscard]] Result run() const{
+        std::vector<uint64_t> regs = m_prog.regs;
+        uint64_t* const r = regs.data();
+        const uint32_t* const code = m_prog.code.data();
+        const uint32_t* pc = code;
+
+#if defined(__GNUC__)
+        // In BcOp order
+        static void* const handlers[] = {
+            &&op_mov, &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_add_k, &&op_sub_k, &&op_mul_k,
+            &&op_div_k, &&op_jmp, &&op_br, &&op_bne, &&op_bne_k, &&op_mov_jmp, &&op_exit,
+        };
+#define VM_CASE(op) op_##op
+#define VM_NEXT() goto *handlers[*pc]
+        VM_NEXT();
+#else
+#define VM_CASE(op) case BcOp::op
+#define VM_NEXT() goto dispatch
+    dispatch:
+        switch (static_cast<BcOp>(*pc)) {
+#endif
+#define VM_IMM(at) (uint64_t{pc[at]} | uint64_t{pc[(at) + 1]} << 32)
+
+    VM_CASE(mov):
+        r[pc[1]] = r[pc[2]];
+        pc += 3;
+        VM_NEXT();
+    VM_CASE(add):
+        r[pc[1]] = r[pc[2]] + r[pc[3]];
+        pc += 4;
+        VM_NEXT();
+    VM_CASE(sub):
+        r[pc[1]] = r[pc[2]] - r[pc[3]];
+        pc += 4;
+        VM_NEXT();
+    VM_CASE(mul):
+        r[pc[1]] = r[pc[2]] * r[pc[3]];
+        pc += 4;
+        VM_NEXT();
+    VM_CASE(div):
+        if (r[pc[3]] == 0) {
+            return {.exit_code = 0, .signal = SIGFPE};
+        }
+        r[pc[1]] = r[pc[2]] / r[pc[3]];
+        pc += 4;
+        VM_NEXT();
+    VM_CASE(add_k):
+        r[pc[1]] = r[pc[2]] + VM_IMM(3);
+        pc += 5;
+        VM_NEXT();
+    VM_CASE(sub_k):
+        r[pc[1]] = r[pc[2]] - VM_IMM(3);
+        pc += 5;
+        VM_NEXT();
+    VM_CASE(mul_k):
+        r[pc[1]] = r[pc[2]] * VM_IMM(3);
+        pc += 5;
+        VM_NEXT();
+    VM_CASE(div_k):
+        // Division by a constant zero is left for run time, where it faults
+        if (VM_IMM(3) == 0) {
+            return {.exit_code = 0, .signal = SIGFPE};
+        }
+        r[pc[1]] = r[pc[2]] / VM_IMM(3);
+        pc += 5;
+        VM_NEXT();
+    VM_CASE(jmp):
+        pc = code + pc[1];
+        VM_NEXT();
+    VM_CASE(br):
+        pc = code + (r[pc[1]] != 0 ? pc[2] : pc[3]);
+        VM_NEXT();
+    VM_CASE(bne):
+        pc = code + (r[pc[1]] != r[pc[2]] ? pc[3] : pc[4]);
+        VM_NEXT();
+    VM_CASE(bne_k):
+        pc = code + (r[pc[1]] != VM_IMM(2) ? pc[4] : pc[5]);
+        VM_NEXT();
+    VM_CASE(mov_jmp):
+        r[pc[1]] = r[pc[2]];
+        pc = code + pc[3];
+        VM_NEXT();
+    VM_CASE(exit):
+        return {.exit_code = static_cast<int>(r[pc[1]] & 0xFF), .signal = 0};
+
+#if !defined(__GNUC__)
+        }
+        return {.exit_code = 0, .signal = SIGILL};
+#endif
+#undef VM_IMM
+#undef VM_NEXT
+#undef VM_CASE
+    }
+
+private:
+    const BytecodeProg& m_prog;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include <unistd.h>
+
+// Each test is a plain executable run by ctest. Failed checks are reported on stderr as they happen,
+// and the test exits non-zero if there were any.
+namespace check {
+
+inline int failures = 0;
+
+inline void expect(const bool ok, const std::string_view what){
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+template <typename T, typename U>
+void expect_eq(const T& actual, const U& expected, const std::string_view what){
+    if (!(actual == expected)) {
+        std::cerr << "FAILED: " << what << ": got " << actual << ", expected " << expected << std::endl;
+        failures++;
+    }
+}
+
+inline int result(){
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// A source file under /tmp that is removed again when the test is done with it
+class TempSource{
+public:
+    explicit TempSource(const std::string_view text){
+        char path[] = "/tmp/hydro-test-XXXXXX.hy";
+        const int fd = mkstemps(path, 3);
+        if (fd < 0) {
+            std::cerr << "Could not create a temporary file" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        ::close(fd);
+        m_path = path;
+        std::ofstream(m_path, std::ios::binary) << text;
+    }
+
+    TempSource(const TempSource&) = delete;
+
+    TempSource& operator=(const TempSource&) = delete;
+
+    ~TempSource(){
+        ::unlink(m_path.c_str());
+    }
+
+    [[nodiscard]] const std::string& path() const{
+        return m_path;
+    }
+
+private:
+    std::string m_path;
+};
+
+}
@@ -0,0 +1,55 @@
+#include <string>
+
+#include "check.h"
+#include "driver.h"
+
+// A long left-leaning chain like `a + a + ... + a` nests one node per term, so every pass over
+// expressions has to walk it without recursing. 100k terms is a 400 KB source.
+
+namespace {
+
+constexpr int terms = 100000;
+
+std::string chain(const std::string& term){
+    std::string expr = term;
+    for (int i = 1; i < terms; i++) {
+        expr += " + " + term;
+    }
+    return expr;
+}
+
+void run_all(const std::string& source, const int expected, const std::string& what){
+    const check::TempSource file(source);
+    for (const Engine engine : {Engine::jit, Engine::vm}) {
+        try {
+            const RunResult result = run_file(file.path(), file.path(), {}, engine);
+            check::expect_eq(result.exit_code, expected, what + (engine == Engine::jit ? " (jit)" : " (vm)"));
+        }
+        catch (const CompileError& e) {
+            check::expect(false, what + ": " + e.what());
+        }
+    }
+}
+
+}
+
+int main(){
+    // Folded down to a constant before it reaches the IR
+    run_all("let a = 1;\nlet b = " + chain("a") + ";\nexit(b / 1000);\n", terms / 1000, "constant chain");
+
+    // `a` is only known at run time, so the chain is lowered to IR as it is
+    run_all("let a = 0;\nlet i = 3;\nwhile (i) {\n    a = a + 1;\n    i = i - 1;\n}\nlet b = " + chain("a")
+                + ";\nexit(b / 1000);\n",
+            3 * terms / 1000 % 256, "chain of a variable");
+
+    // The first undeclared name is still the one reported
+    const check::TempSource undeclared("let a = 1;\nexit(" + chain("a") + " + b + c);\n");
+    try {
+        compile_ir(undeclared.path(), undeclared.path(), {}, nullptr);
+        check::expect(false, "undeclared identifier accepted");
+    }
+    catch (const CompileError& e) {
+        check::expect_eq(std::string(e.what()), "Undeclared identifier: b", "undeclared identifier");
+    }
+    return check::result();
+}
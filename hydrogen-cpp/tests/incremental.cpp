@@ -0,0 +1,218 @@
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "incremental.h"
+#include "program_gen.h"
+
+// After every edit, IncrementalParser has to agree with parsing the edited text from scratch: the same
+// program, identifier lines included, or the same diagnostic. Edits are random insertions, deletions
+// and copies, each undone again now and then so that programs keep moving between broken and fixed.
+
+namespace {
+
+class Printer{
+public:
+    Printer(const Ast& ast, const Interner& interner)
+        : m_ast(ast),
+          m_interner(interner)
+    {}
+
+    std::string print(){
+        body(m_ast.root);
+        return m_out;
+    }
+
+private:
+    const Ast& m_ast;
+    const Interner& m_interner;
+    ExprWalker m_walker{};
+    std::string m_out{};
+
+    void ident(const Ident& ident){
+        m_out += std::string(m_interner.name(ident.symbol)) + "@" + std::to_string(ident.line) + " ";
+    }
+
+    // Reverse Polish, which needs no parentheses
+    void expr(const ExprId root){
+        static constexpr const char* ops[] = {"", "", "+", "-", "*", "/"};
+        for (const ExprId node : m_walker.postorder(m_ast, root)) {
+            switch (m_ast.kind(node)) {
+            case ExprKind::int_lit:
+                m_out += std::to_string(m_ast.int_lit(node)) + " ";
+                break;
+            case ExprKind::ident:
+                ident(m_ast.ident(node));
+                break;
+            default:
+                m_out += std::string(ops[static_cast<size_t>(m_ast.kind(node))]) + " ";
+                break;
+            }
+        }
+    }
+
+    void body(const BodyId body){
+        m_out += "{\n";
+        for (const StmtId stmt : m_ast.stmts(body)) {
+            m_out += std::string(to_string(m_ast.kind(stmt))) + " ";
+            switch (m_ast.kind(stmt)) {
+            case StmtKind::exit:
+                expr(m_ast.exit_expr(stmt));
+                break;
+            case StmtKind::let:
+            case StmtKind::assign:
+                ident(m_ast.store(stmt).ident);
+                expr(m_ast.store(stmt).expr);
+                break;
+            case StmtKind::scope:
+                this->body(m_ast.scope_body(stmt));
+                break;
+            case StmtKind::if_:
+                for (const Arm& arm : m_ast.if_arms(stmt)) {
+                    if (arm.cond != no_expr) {
+                        expr(arm.cond);
+                    }
+                    this->body(arm.body);
+                }
+                break;
+            case StmtKind::while_:
+                expr(m_ast.while_stmt(stmt).cond);
+                this->body(m_ast.while_stmt(stmt).body);
+                break;
+            }
+            m_out += "\n";
+        }
+        m_out += "}";
+    }
+};
+
+std::string full_parse(const std::string& text){
+    try {
+        Interner interner;
+        const std::optional<Ast> ast = Parser(Tokenizer(text, interner)).parse_prog();
+        return Printer(ast.value(), interner).print();
+    }
+    catch (const CompileError& e) {
+        return std::string("error: ") + e.what();
+    }
+}
+
+std::string snapshot(const IncrementalParser& parser){
+    try {
+        return Printer(parser.snapshot(), parser.interner()).print();
+    }
+    catch (const CompileError& e) {
+        return std::string("error: ") + e.what();
+    }
+}
+
+// Applies the edit and returns what the parser now holds, checking that a failed edit and snapshot()
+// report the same error
+std::string apply(IncrementalParser& parser, const IncrementalParser::Edit& edit){
+    try {
+        parser.apply(edit);
+    }
+    catch (const CompileError& e) {
+        const std::string error = std::string("error: ") + e.what();
+        check::expect_eq(snapshot(parser), error, "snapshot of a broken text");
+        return error;
+    }
+    return snapshot(parser);
+}
+
+constexpr const char* fragments[] = {
+    "let n = 1;\n", "x = 2;\n", "exit(v0);\n", "{", "}", "{\n", "}\n", "if (v0) {\n", "} elif (0) {\n",
+    "} else {\n", "while (0) {\n", "(", ")", ";", "=", "+ 1", " * v0", "\n", "/*", "*/", "// note\n", "$",
+    "let", "v0", "99999999999999999999",
+};
+
+struct Undo{
+    size_t offset;
+    std::string removed;
+    size_t inserted;
+};
+
+void fuzz(const std::string& source, const uint64_t seed){
+    std::mt19937_64 rng(seed);
+    const auto below = [&rng](const size_t bound){
+        return static_cast<size_t>(rng() % bound);
+    };
+
+    std::string text = source;
+    IncrementalParser parser(text);
+    std::vector<Undo> undo;
+    for (int step = 0; step < 60; step++) {
+        IncrementalParser::Edit edit{};
+        std::string inserted;
+        if (!undo.empty() && below(3) == 0) {
+            const Undo last = undo.back();
+            undo.pop_back();
+            inserted = last.removed;
+            edit = {.offset = last.offset, .removed = last.inserted, .inserted = {}};
+        }
+        else {
+            edit.offset = below(text.size() + 1);
+            switch (below(3)) {
+            case 0:
+                edit.removed = std::min(below(24), text.size() - edit.offset);
+                break;
+            case 1:
+                inserted = fragments[below(std::size(fragments))];
+                break;
+            default: {
+                const size_t from = below(text.size() + 1);
+                inserted = text.substr(from, below(40));
+                break;
+            }
+            }
+            undo.push_back({.offset = edit.offset, .removed = text.substr(edit.offset, edit.removed),
+                            .inserted = inserted.size()});
+        }
+        edit.inserted = inserted;
+        text.replace(edit.offset, edit.removed, inserted);
+
+        const std::string expected = full_parse(text);
+        const std::string actual = apply(parser, edit);
+        if (actual != expected) {
+            check::expect(false, "program " + std::to_string(seed) + ", edit " + std::to_string(step) + " at "
+                                     + std::to_string(edit.offset) + ": got " + actual.substr(0, 200)
+                                     + ", expected " + expected.substr(0, 200));
+            return;
+        }
+        check::expect_eq(parser.text(), text, "edited text");
+    }
+}
+
+// An edit above a statement that doesn't parse moves it down a line, and the error has to follow it
+void error_below_an_edit(){
+    std::string text;
+    for (int line = 1; line <= 12; line++) {
+        text += "let a" + std::to_string(line) + " = 1;\n";
+    }
+    IncrementalParser parser(text);
+    const IncrementalParser::Edit edits[] = {
+        {.offset = text.find("let a11") + 11, .removed = 1, .inserted = {}},
+        {.offset = text.size() - 1, .removed = 0, .inserted = "foo"},
+        {.offset = text.find("let a2"), .removed = 0, .inserted = "let a = 1;\n"},
+    };
+    for (const IncrementalParser::Edit& edit : edits) {
+        text.replace(edit.offset, edit.removed, edit.inserted);
+        check::expect_eq(apply(parser, edit), full_parse(text), "edit at " + std::to_string(edit.offset));
+    }
+}
+
+}
+
+int main(){
+    error_below_an_edit();
+    uint64_t seed = 1;
+    for (const program_gen::Shape shape : program_gen::shapes) {
+        for (int i = 0; i < 20; i++, seed++) {
+            fuzz(program_gen::generate(shape, 1500, seed), seed);
+        }
+    }
+    return check::result();
+}
@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <string>
+
+#include "check.h"
+#include "driver.h"
+
+// Whatever ParallelLexer splits a file into, it has to fail with the diagnostic lexing on one thread
+// gives, including when a parse error comes before a lex error further on.
+
+namespace {
+
+// Enough valid statements to make the source a few chunks long
+std::string filler(const std::string& prefix){
+    std::string text;
+    for (int i = 0; text.size() < 4 * ParallelLexer::min_chunk_bytes; i++) {
+        text += "let " + prefix + std::to_string(i) + " = " + std::to_string(i) + " * 2;\n";
+    }
+    return text;
+}
+
+std::string line_after(const std::string& text){
+    return std::to_string(std::count(text.begin(), text.end(), '\n') + 1);
+}
+
+std::string diagnostic(const std::string& path, const size_t threads, ThreadPool* pool = nullptr){
+    try {
+        compile_ir(path, path, {.lex_threads = threads, .pool = pool}, nullptr);
+        return "no error";
+    }
+    catch (const CompileError& e) {
+        return e.what();
+    }
+}
+
+// The way the daemon compiles: on a worker of a pool that also lexes the chunks
+std::string diagnostic_on_pool(const std::string& path){
+    static ThreadPool pool(4);
+    std::string result;
+    pool.run_batch(1, [&path, &result](size_t){ result = diagnostic(path, pool.size(), &pool); });
+    return result;
+}
+
+void compare(const std::string& source, const std::string& expected, const std::string& what){
+    const check::TempSource file(source);
+    const std::string sequential = diagnostic(file.path(), 1);
+    check::expect_eq(sequential, expected, what + " (1 thread)");
+    for (const size_t threads : {2, 4, 8}) {
+        check::expect_eq(diagnostic(file.path(), threads), sequential,
+                         what + " (" + std::to_string(threads) + " threads)");
+    }
+    check::expect_eq(diagnostic_on_pool(file.path()), sequential, what + " (shared pool)");
+}
+
+}
+
+int main(){
+    const std::string body = filler("a");
+    const std::string more = filler("b");
+
+    compare("let x = 1;\nlet y = ;\n" + body + "let z = $;\n", "[Parser Error] Expected expression on line 2",
+            "parse error before a lex error");
+    compare("let x = 1;\n" + body + "let y = $;\n" + more + "let z = ;\n", "Invalid token",
+            "lex error before a parse error");
+    compare(body + "let y = 99999999999999999999;\n" + more + "let z = $;\n",
+            "Integer literal out of range on line " + line_after(body), "first of two lex errors");
+    compare("/* " + body + " */ let y = (;\n" + more + "$\n",
+            "[Parser Error] Expected expression on line " + line_after(body), "parse error after a comment across chunks");
+    compare(body + "exit(a7 + 1);\n" + more, "no error", "valid program");
+    return check::result();
+}